@@ -0,0 +1,268 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * anim.c: interpolates properties of the unlock indicator over time and
+ *         schedules the frames to show them, within a CPU budget.
+ *
+ * See LICENSE for licensing information
+ *
+ */
+#include <stdbool.h>
+#include <math.h>
+#include <xcb/xcb.h>
+#include <ev.h>
+
+#include "anim.h"
+#include "stats.h"
+#include "unlock_indicator.h"
+
+extern struct ev_loop *main_loop;
+
+/* The frame rate of animations when rendering is cheap enough. */
+#define ANIM_MAX_FPS 60
+/* If the budget does not allow this frame rate, fades are skipped and only
+ * the spinner is animated (at a lower frame rate). */
+#define ANIM_MIN_FPS 15
+/* The render time of a frame is averaged with this weight for the newest one. */
+#define COST_WEIGHT 0.2
+
+typedef struct {
+    /* The transition from "from" to "to", started at "start" (milliseconds, see
+     * stats_now()). A duration of 0 means the value arrived at "to". */
+    double from;
+    double to;
+    double start;
+    double duration;
+    /* Spinning properties go from 0 to 1 in period milliseconds, over and
+     * over, in steps steps. A period of 0 means the property does not spin. */
+    double period;
+    int steps;
+    /* The value as of the last frame. */
+    double value;
+} property_t;
+
+static property_t properties[ANIM_COUNT];
+
+/* The share of one CPU core which may be spent on rendering animation frames
+ * (--anim-budget), 0 if animations are disabled. */
+static double budget;
+
+/* The average time (in milliseconds) it took to render a partial frame, see
+ * anim_frame_rendered(). */
+static double frame_cost;
+
+static ev_timer frame_watcher;
+
+/* Whether the monitors are blanked, see anim_suspend(). */
+static bool suspended;
+
+/*
+ * Returns the time between two animation frames (in seconds) for which the
+ * average frame stays within the budget.
+ *
+ */
+static double frame_interval(void) {
+    double interval = (frame_cost / 1000.0) / budget;
+    if (interval < 1.0 / ANIM_MAX_FPS)
+        return 1.0 / ANIM_MAX_FPS;
+    if (interval > 1.0)
+        return 1.0;
+    return interval;
+}
+
+/*
+ * Returns whether animation frames are too expensive for fades.
+ *
+ */
+static bool reduced_quality(void) {
+    return (frame_interval() > 1.0 / ANIM_MIN_FPS);
+}
+
+/*
+ * Returns the value of the given property at the given time. Transitions ease
+ * out, so that they start fast and slow down at the end.
+ *
+ */
+static double value_at(const property_t *property, double now) {
+    if (property->period > 0) {
+        double phase = fmod((now - property->start) / property->period, 1.0);
+        return floor(phase * property->steps) / property->steps;
+    }
+    if (property->duration <= 0 || now >= property->start + property->duration)
+        return property->to;
+
+    double t = (now - property->start) / property->duration;
+    t = 1 - (1 - t) * (1 - t);
+    return property->from + (property->to - property->from) * t;
+}
+
+/*
+ * Returns whether any property changes over time.
+ *
+ */
+static bool animating(void) {
+    for (int i = 0; i < ANIM_COUNT; i++)
+        if (properties[i].period > 0 || properties[i].duration > 0)
+            return true;
+    return false;
+}
+
+/*
+ * Advances all properties and schedules a frame if any of them changed
+ * visibly. Stops itself once nothing is animating anymore, so that there are
+ * no wakeups at all while idle.
+ *
+ */
+static void frame_cb(EV_P_ ev_timer *w, int revents) {
+    double now = stats_now();
+    bool changed = false;
+
+    for (int i = 0; i < ANIM_COUNT; i++) {
+        property_t *property = &properties[i];
+        double value = value_at(property, now);
+        if (value != property->value) {
+            property->value = value;
+            changed = true;
+        }
+        if (property->duration > 0 && value == property->to)
+            property->duration = 0;
+    }
+    if (changed)
+        schedule_redraw();
+
+    if (!animating()) {
+        ev_timer_stop(main_loop, &frame_watcher);
+        return;
+    }
+    frame_watcher.repeat = frame_interval();
+    ev_timer_again(main_loop, &frame_watcher);
+}
+
+/*
+ * Starts rendering animation frames, unless it is already running.
+ *
+ */
+static void start_frames(void) {
+    if (suspended || ev_is_active(&frame_watcher))
+        return;
+    frame_watcher.repeat = frame_interval();
+    ev_timer_again(main_loop, &frame_watcher);
+}
+
+/*
+ * Enables animations with the given budget (in percent of one CPU core). With
+ * a budget of 0 (or without calling this function at all), every property
+ * jumps to its new value immediately and nothing spins.
+ *
+ */
+void anim_init(double budget_percent) {
+    budget = budget_percent / 100.0;
+    ev_init(&frame_watcher, frame_cb);
+}
+
+/*
+ * Moves the given property to the given value over duration milliseconds.
+ * Does nothing if it is already on its way there.
+ *
+ */
+void anim_start(anim_property_t id, double to, double duration) {
+    property_t *property = &properties[id];
+    if (property->period == 0 && property->to == to)
+        return;
+
+    property->period = 0;
+    property->to = to;
+    if (budget <= 0 || duration <= 0 || suspended || reduced_quality()) {
+        property->value = to;
+        property->duration = 0;
+        return;
+    }
+    property->from = property->value;
+    property->start = stats_now();
+    property->duration = duration;
+    start_frames();
+}
+
+/*
+ * Spins the given property with the given period (in milliseconds), until
+ * anim_stop() is called.
+ *
+ */
+void anim_spin(anim_property_t id, double period, int steps) {
+    property_t *property = &properties[id];
+    if (budget <= 0 || property->period == period)
+        return;
+
+    property->period = period;
+    property->steps = steps;
+    property->duration = 0;
+    property->start = stats_now();
+    property->value = property->to = 0;
+    start_frames();
+}
+
+/*
+ * Stops the given property where it is heading to.
+ *
+ */
+void anim_stop(anim_property_t id) {
+    property_t *property = &properties[id];
+    if (property->period == 0 && property->duration == 0)
+        return;
+
+    property->period = 0;
+    property->duration = 0;
+    property->value = property->to;
+}
+
+/*
+ * Stops rendering animation frames while the monitors are blanked (suspend is
+ * true): running transitions are finished right away and spinners stay where
+ * they are. They continue once the monitors are back on.
+ *
+ */
+void anim_suspend(bool suspend) {
+    if (suspend == suspended)
+        return;
+    suspended = suspend;
+
+    if (!suspend) {
+        if (animating())
+            start_frames();
+        return;
+    }
+
+    for (int i = 0; i < ANIM_COUNT; i++) {
+        if (properties[i].duration > 0) {
+            properties[i].value = properties[i].to;
+            properties[i].duration = 0;
+        }
+    }
+    ev_timer_stop(main_loop, &frame_watcher);
+}
+
+bool anim_spinning(anim_property_t id) {
+    return (properties[id].period > 0);
+}
+
+/*
+ * Returns the value of the given property for the frame being rendered.
+ *
+ */
+double anim_value(anim_property_t id) {
+    return properties[id].value;
+}
+
+/*
+ * Records how long rendering a partial frame took, which determines the frame
+ * rate of the animations.
+ *
+ */
+void anim_frame_rendered(double ms) {
+    if (frame_cost == 0)
+        frame_cost = ms;
+    else
+        frame_cost = COST_WEIGHT * ms + (1 - COST_WEIGHT) * frame_cost;
+}
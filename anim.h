@@ -0,0 +1,21 @@
+#ifndef _ANIM_H
+#define _ANIM_H
+
+#include <stdbool.h>
+
+typedef enum {
+    ANIM_OPACITY = 0, /* opacity of the unlock indicator, from 0 to 1 */
+    ANIM_SPINNER = 1, /* position of the spinner while verifying, from 0 to 1 */
+    ANIM_COUNT
+} anim_property_t;
+
+void anim_init(double budget);
+void anim_start(anim_property_t property, double to, double duration);
+void anim_spin(anim_property_t property, double period, int steps);
+void anim_stop(anim_property_t property);
+void anim_suspend(bool suspend);
+bool anim_spinning(anim_property_t property);
+double anim_value(anim_property_t property);
+void anim_frame_rendered(double ms);
+
+#endif
@@ -0,0 +1,343 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * bench.c: renders frames with draw_image()/redraw_screen() for a range of
+ *          resolutions, Xinerama layouts, background images and indicator
+ *          states, and reports frames per second and the bytes written to
+ *          the X server. Also measures the password input buffer. Needs an
+ *          X server, e.g. run under xvfb-run(1).
+ *
+ * See LICENSE for licensing information
+ *
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+#include <xcb/xcb.h>
+#include <ev.h>
+#include <cairo.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "xcb.h"
+#include "unlock_indicator.h"
+#include "xinerama.h"
+#include "theme.h"
+#include "input.h"
+
+/*******************************************************************************
+ * Variables which are otherwise defined in i3lock.c.
+ ******************************************************************************/
+
+char color[7] = "ffffff";
+char insidevercolor[9] = "006effbf";
+char insidewrongcolor[9] = "fa0000bf";
+char insidecolor[9] = "000000bf";
+char ringvercolor[9] = "3300faff";
+char ringwrongcolor[9] = "7d3300ff";
+char ringcolor[9] = "337d00ff";
+char linecolor[9] = "000000ff";
+char textcolor[9] = "000000ff";
+char keyhlcolor[9] = "33db00ff";
+char bshlcolor[9] = "db3300ff";
+char separatorcolor[9] = "000000ff";
+int internal_line_source = 0;
+int screen_number = -1;
+uint32_t last_resolution[2];
+xcb_window_t win;
+bool debug_mode = false;
+struct ev_loop *main_loop = NULL;
+bool unlock_indicator = true;
+char *modifier_string = "Caps Lock";
+cairo_surface_t *img = NULL;
+bool tile = false;
+image_mode_t image_mode = IMAGE_MODE_NONE;
+bool core_indicator = false;
+char *font_name = NULL;
+bool show_failed_attempts = true;
+int failed_attempts = 3;
+
+extern unlock_state_t unlock_state;
+extern pam_state_t pam_state;
+
+typedef enum {
+    IMAGE_NONE = 0,
+    IMAGE_UNTILED = 1,
+    IMAGE_TILED = 2,
+    IMAGE_FILL = 3
+} image_kind_t;
+
+static const char *image_kind_names[] = {"none", "untiled", "tiled", "fill"};
+
+static const uint32_t resolutions[][2] = {
+    {1920, 1080},
+    {2560, 1440},
+    {3840, 2160},
+    {7680, 4320},
+};
+
+#define MAX_SCREENS 6
+
+/*
+ * The bench sets img itself and never uses the background cache, so there is
+ * nothing to decode.
+ *
+ */
+void request_image_decode(void) {
+}
+
+void image_uploaded(void) {
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*
+ * Returns the number of bytes this process wrote so far (all write calls, so
+ * mostly the X11 socket), or -1 if /proc/self/io is not available.
+ *
+ */
+static long long bytes_written(void) {
+    FILE *io = fopen("/proc/self/io", "r");
+    char line[128];
+    long long wchar = -1;
+
+    if (!io)
+        return -1;
+    while (fgets(line, sizeof(line), io)) {
+        if (sscanf(line, "wchar: %lld", &wchar) == 1)
+            break;
+    }
+    fclose(io);
+    return wchar;
+}
+
+/*
+ * Waits until the X server processed all requests, so that the time spent in
+ * the server is included in the measurement.
+ *
+ */
+static void sync_with_server(void) {
+    free(xcb_get_input_focus_reply(conn, xcb_get_input_focus(conn), NULL));
+}
+
+/*
+ * Creates an image of the given size with a gradient, standing in for a
+ * wallpaper.
+ *
+ */
+static cairo_surface_t *create_test_image(int width, int height) {
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+    cairo_t *ctx = cairo_create(surface);
+    cairo_pattern_t *gradient = cairo_pattern_create_linear(0, 0, width, height);
+
+    cairo_pattern_add_color_stop_rgb(gradient, 0, 0.1, 0.2, 0.4);
+    cairo_pattern_add_color_stop_rgb(gradient, 1, 0.8, 0.5, 0.2);
+    cairo_set_source(ctx, gradient);
+    cairo_paint(ctx);
+
+    cairo_pattern_destroy(gradient);
+    cairo_destroy(ctx);
+    return surface;
+}
+
+/*
+ * Splits the given resolution into the given number of side-by-side
+ * Xinerama screens.
+ *
+ */
+static void set_layout(const uint32_t *resolution, int screens) {
+    static Rect layout[MAX_SCREENS];
+
+    for (int i = 0; i < screens; i++) {
+        layout[i].x = i * (resolution[0] / screens);
+        layout[i].y = 0;
+        layout[i].width = resolution[0] / screens;
+        layout[i].height = resolution[1];
+    }
+    xr_resolutions = layout;
+    xr_screens = screens;
+}
+
+/*
+ * Renders one cold frame (background included) and then the given number of
+ * frames cycling through all combinations of PAM and unlock state, like
+ * while typing a password.
+ *
+ */
+static void bench_configuration(const uint32_t *resolution, int screens, image_kind_t image_kind,
+                                cairo_surface_t **images, int frames) {
+    set_layout(resolution, screens);
+    img = images[image_kind];
+    tile = (image_kind == IMAGE_TILED);
+    image_mode = (image_kind == IMAGE_FILL ? IMAGE_MODE_FILL : IMAGE_MODE_NONE);
+    last_resolution[0] = resolution[0];
+    last_resolution[1] = resolution[1];
+
+    if (win != XCB_NONE)
+        xcb_destroy_window(conn, win);
+    win = xcb_generate_id(conn);
+    xcb_create_window(conn, XCB_COPY_FROM_PARENT, win, screen->root,
+                      0, 0, resolution[0], resolution[1], 0,
+                      XCB_WINDOW_CLASS_INPUT_OUTPUT, XCB_WINDOW_CLASS_COPY_FROM_PARENT,
+                      0, NULL);
+
+    free_background();
+    damage_screen();
+
+    long long bytes_before = bytes_written();
+    double cold_start = now_ms();
+    redraw_screen();
+    sync_with_server();
+    double cold = now_ms() - cold_start;
+
+    double start = now_ms();
+    for (int frame = 0; frame < frames; frame++) {
+        pam_state = (frame / 4) % 3;
+        unlock_state = frame % 4;
+        if (unlock_state == STATE_KEY_ACTIVE || unlock_state == STATE_BACKSPACE_ACTIVE)
+            highlight_indicator(unlock_state);
+        redraw_screen();
+    }
+    sync_with_server();
+    double elapsed = now_ms() - start;
+    long long bytes_after = bytes_written();
+
+    printf("%4ux%-4u %d screen%s %-8s cold %9.2f ms %9.1f fps",
+           resolution[0], resolution[1], screens, (screens == 1 ? " " : "s"),
+           image_kind_names[image_kind], cold, frames / (elapsed / 1000.0));
+    if (bytes_before >= 0 && bytes_after >= 0)
+        printf(" %12.1f KiB written", (bytes_after - bytes_before) / 1024.0);
+    printf("\n");
+}
+
+/*
+ * Fills the password buffer with characters of 1 to 4 bytes until it is full
+ * and empties it again with backspace, for the given number of rounds.
+ * Reports the average and the worst time of a single key.
+ *
+ */
+static void bench_input(int rounds) {
+    static const char *characters[] = {"a", "\xc3\xa4", "\xe2\x82\xac", "\xf0\x9f\x94\x92"};
+    static input_buffer_t input;
+    double append_total = 0, append_max = 0, backspace_total = 0, backspace_max = 0;
+    long appends = 0, backspaces = 0;
+
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0;; i++) {
+            const char *character = characters[i % 4];
+            double start = now_ms();
+            bool appended = input_append(&input, character, strlen(character));
+            double ms = now_ms() - start;
+            if (!appended)
+                break;
+            append_total += ms;
+            if (ms > append_max)
+                append_max = ms;
+            appends++;
+        }
+        for (;;) {
+            double start = now_ms();
+            bool removed = input_backspace(&input);
+            double ms = now_ms() - start;
+            if (!removed)
+                break;
+            backspace_total += ms;
+            if (ms > backspace_max)
+                backspace_max = ms;
+            backspaces++;
+        }
+    }
+    input_clear(&input);
+
+    printf("input append    %9.1f ns avg %9.1f ns max\n",
+           append_total / appends * 1e6, append_max * 1e6);
+    printf("input backspace %9.1f ns avg %9.1f ns max\n",
+           backspace_total / backspaces * 1e6, backspace_max * 1e6);
+}
+
+/*
+ * Toggles Caps Lock and Num Lock like XKB state notifications would and
+ * reports how long updating the modifier label takes. Skipped if there is no
+ * XKB configuration to compile a keymap from.
+ *
+ */
+static void bench_modifiers(int rounds) {
+    struct xkb_context *context = xkb_context_new(0);
+    struct xkb_keymap *keymap = (context ? xkb_keymap_new_from_names(context, NULL, 0) : NULL);
+    if (keymap == NULL) {
+        printf("modifier label  skipped, could not compile a keymap\n");
+        xkb_context_unref(context);
+        return;
+    }
+    struct xkb_state *state = xkb_state_new(keymap);
+    xkb_mod_index_t caps_index = xkb_keymap_mod_get_index(keymap, XKB_MOD_NAME_CAPS);
+    xkb_mod_index_t num_index = xkb_keymap_mod_get_index(keymap, XKB_MOD_NAME_NUM);
+    xkb_mod_mask_t caps = (caps_index != XKB_MOD_INVALID ? UINT32_C(1) << caps_index : 0);
+    xkb_mod_mask_t num = (num_index != XKB_MOD_INVALID ? UINT32_C(1) << num_index : 0);
+    double total = 0, max = 0;
+
+    input_keymap_changed();
+    for (int round = 0; round < rounds; round++) {
+        xkb_state_update_mask(state, 0, 0, (round % 2 ? caps | num : caps), 0, 0, 0);
+        double start = now_ms();
+        input_update_modifiers(keymap, state);
+        double ms = now_ms() - start;
+        total += ms;
+        if (ms > max)
+            max = ms;
+    }
+
+    printf("modifier label  %9.1f ns avg %9.1f ns max (%s)\n",
+           total / rounds * 1e6, max * 1e6, input_modifier_label());
+    xkb_state_unref(state);
+    xkb_keymap_unref(keymap);
+    xkb_context_unref(context);
+}
+
+int main(int argc, char *argv[]) {
+    int frames = 200;
+    int screennr;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--core-indicator") == 0)
+            core_indicator = true;
+        else if ((frames = atoi(argv[i])) <= 0)
+            errx(EXIT_FAILURE, "Syntax: %s [--core-indicator] [frames per configuration]", argv[0]);
+    }
+
+    if ((conn = xcb_connect(NULL, &screennr)) == NULL ||
+        xcb_connection_has_error(conn))
+        errx(EXIT_FAILURE, "Could not connect to X11, maybe you need to set DISPLAY?");
+    screen = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
+
+    init_theme();
+    srand(0);
+
+    cairo_surface_t *images[] = {
+        NULL,
+        create_test_image(1920, 1080),
+        create_test_image(256, 256),
+        create_test_image(2560, 1600),
+    };
+
+    bench_input(1000);
+    bench_modifiers(10000);
+
+    printf("%d frames per configuration\n", frames);
+    for (size_t i = 0; i < sizeof(resolutions) / sizeof(resolutions[0]); i++)
+        for (int screens = 1; screens <= MAX_SCREENS; screens++)
+            for (int image_kind = IMAGE_NONE; image_kind <= IMAGE_FILL; image_kind++)
+                bench_configuration(resolutions[i], screens, image_kind, images, frames);
+
+    xcb_disconnect(conn);
+    return 0;
+}
@@ -0,0 +1,371 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * bgcache.c: keeps the rendered backgrounds of the last few screen layouts in
+ *            $XDG_CACHE_HOME/i3lock-color, in a raw format which is mapped
+ *            into memory as it is, so that a locked screen with the same image
+ *            and layout does not need to decode and scale the image again.
+ *
+ * See LICENSE for licensing information
+ *
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <xcb/xcb.h>
+#include <cairo.h>
+
+#include "i3lock.h"
+#include "bgcache.h"
+#include "unlock_indicator.h"
+#include "xinerama.h"
+#include "theme.h"
+
+/* Number of cached backgrounds to keep, the least recently used ones are
+ * deleted when storing a new one. */
+#define BGCACHE_MAX_ENTRIES 4
+
+/* Identifies the file format. Needs to be changed whenever the format or the
+ * way backgrounds are rendered changes. */
+#define BGCACHE_MAGIC "i3lkbg1"
+
+extern bool debug_mode;
+extern bool tile;
+extern image_mode_t image_mode;
+
+/* The header at the start of each cache file. The pixels follow at
+ * data_offset, which is a multiple of the page size, in CAIRO_FORMAT_RGB24
+ * (the background is opaque, so this is the same as premultiplied ARGB32 with
+ * the alpha byte ignored). */
+struct bgcache_header {
+    char magic[8];
+    uint64_t key;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t data_offset;
+};
+
+/* The directory the backgrounds are cached in, NULL if the cache is not used
+ * (no image, or no cache directory). */
+static char *cache_dir;
+
+/* Identifies the image file, so that changing it invalidates the cache. */
+static const char *cached_image_path;
+static struct stat cached_image_stat;
+
+/*
+ * Creates the given directory (but not its parents) if it does not exist yet.
+ *
+ */
+static bool ensure_directory(const char *path) {
+    if (mkdir(path, 0700) == 0 || errno == EEXIST)
+        return true;
+    DEBUG("could not create cache directory \"%s\": %s\n", path, strerror(errno));
+    return false;
+}
+
+/*
+ * Enables the background cache for the given image. Does nothing if there is
+ * no usable cache directory.
+ *
+ */
+void bgcache_init(const char *image_path) {
+    if (stat(image_path, &cached_image_stat) != 0)
+        return;
+
+    char cache_home[PATH_MAX];
+    const char *xdg_cache_home = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (xdg_cache_home != NULL && xdg_cache_home[0] == '/')
+        snprintf(cache_home, sizeof(cache_home), "%s", xdg_cache_home);
+    else if (home != NULL && home[0] == '/')
+        snprintf(cache_home, sizeof(cache_home), "%s/.cache", home);
+    else
+        return;
+
+    char *dir;
+    if (asprintf(&dir, "%s/i3lock-color", cache_home) == -1)
+        return;
+    if (!ensure_directory(cache_home) || !ensure_directory(dir)) {
+        free(dir);
+        return;
+    }
+
+    cache_dir = dir;
+    cached_image_path = image_path;
+}
+
+/*
+ * Returns whether backgrounds are cached.
+ *
+ */
+bool bgcache_active(void) {
+    return (cache_dir != NULL);
+}
+
+/*
+ * Feeds the given bytes into a 64-bit FNV-1a hash.
+ *
+ */
+static void hash_bytes(uint64_t *hash, const void *data, size_t length) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        *hash ^= bytes[i];
+        *hash *= 1099511628211ULL;
+    }
+}
+
+/*
+ * Returns the key of the background for the current image, screen layout,
+ * placement and background color.
+ *
+ */
+static uint64_t background_key(uint32_t *resolution) {
+    uint64_t key = 14695981039346656037ULL;
+
+    hash_bytes(&key, cached_image_path, strlen(cached_image_path));
+    hash_bytes(&key, &cached_image_stat.st_dev, sizeof(cached_image_stat.st_dev));
+    hash_bytes(&key, &cached_image_stat.st_ino, sizeof(cached_image_stat.st_ino));
+    hash_bytes(&key, &cached_image_stat.st_size, sizeof(cached_image_stat.st_size));
+    hash_bytes(&key, &cached_image_stat.st_mtim, sizeof(cached_image_stat.st_mtim));
+
+    hash_bytes(&key, resolution, 2 * sizeof(uint32_t));
+    hash_bytes(&key, &xr_screens, sizeof(xr_screens));
+    for (int i = 0; i < xr_screens; i++)
+        hash_bytes(&key, &xr_resolutions[i], sizeof(Rect));
+
+    hash_bytes(&key, &image_mode, sizeof(image_mode));
+    hash_bytes(&key, &tile, sizeof(tile));
+    hash_bytes(&key, &theme.background_pixel, sizeof(theme.background_pixel));
+
+    return key;
+}
+
+/*
+ * Returns the path of the cache file with the given key. The caller needs to
+ * free it.
+ *
+ */
+static char *cache_path(uint64_t key) {
+    char *path;
+    if (asprintf(&path, "%s/%016" PRIx64 ".bg", cache_dir, key) == -1)
+        return NULL;
+    return path;
+}
+
+/*
+ * Returns whether there is a cached background for the given resolution (and
+ * the current screen layout), without loading it.
+ *
+ */
+bool bgcache_contains(uint32_t *resolution) {
+    if (!bgcache_active())
+        return false;
+
+    char *path = cache_path(background_key(resolution));
+    if (path == NULL)
+        return false;
+    bool exists = (access(path, R_OK) == 0);
+    free(path);
+    return exists;
+}
+
+struct mapping {
+    void *addr;
+    size_t length;
+};
+
+static const cairo_user_data_key_t mapping_key;
+
+static void unmap_cache_file(void *data) {
+    struct mapping *mapping = data;
+    munmap(mapping->addr, mapping->length);
+    free(mapping);
+}
+
+/*
+ * Returns the cached background for the given resolution (and the current
+ * screen layout), or NULL if there is none. The returned surface directly
+ * uses the memory-mapped cache file and unmaps it when it is destroyed.
+ *
+ */
+cairo_surface_t *bgcache_load(uint32_t *resolution) {
+    if (!bgcache_active())
+        return NULL;
+
+    uint64_t key = background_key(resolution);
+    char *path = cache_path(key);
+    if (path == NULL)
+        return NULL;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    free(path);
+    if (fd == -1)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct bgcache_header)) {
+        close(fd);
+        return NULL;
+    }
+
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return NULL;
+
+    const struct bgcache_header *header = addr;
+    if (memcmp(header->magic, BGCACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->key != key ||
+        header->width != resolution[0] ||
+        header->height != resolution[1] ||
+        header->stride != (uint32_t)cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, header->width) ||
+        (off_t)header->data_offset + (off_t)header->stride * header->height > st.st_size) {
+        DEBUG("ignoring invalid cached background\n");
+        munmap(addr, st.st_size);
+        return NULL;
+    }
+
+    struct mapping *mapping = malloc(sizeof(struct mapping));
+    if (mapping == NULL) {
+        munmap(addr, st.st_size);
+        return NULL;
+    }
+    mapping->addr = addr;
+    mapping->length = st.st_size;
+
+    /* cairo only reads from the surface, PROT_READ is fine. */
+    cairo_surface_t *surface = cairo_image_surface_create_for_data(
+        (unsigned char *)addr + header->data_offset, CAIRO_FORMAT_RGB24,
+        header->width, header->height, header->stride);
+    if (cairo_surface_set_user_data(surface, &mapping_key, mapping, unmap_cache_file) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(surface);
+        unmap_cache_file(mapping);
+        return NULL;
+    }
+
+    DEBUG("using cached background %016" PRIx64 "\n", key);
+    return surface;
+}
+
+/*
+ * Deletes the least recently written cache files, so that at most
+ * BGCACHE_MAX_ENTRIES remain.
+ *
+ */
+static void prune_cache(void) {
+    DIR *dir = opendir(cache_dir);
+    if (dir == NULL)
+        return;
+
+    char *names[BGCACHE_MAX_ENTRIES + 1];
+    time_t mtimes[BGCACHE_MAX_ENTRIES + 1];
+    int count = 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        if (length < 3 || strcmp(entry->d_name + length - 3, ".bg") != 0)
+            continue;
+
+        struct stat st;
+        if (fstatat(dirfd(dir), entry->d_name, &st, 0) != 0)
+            continue;
+
+        /* Keep the newest BGCACHE_MAX_ENTRIES files sorted by mtime (newest
+         * first) and delete everything which falls off the end. */
+        int pos = count;
+        while (pos > 0 && mtimes[pos - 1] < st.st_mtime)
+            pos--;
+        if (pos == BGCACHE_MAX_ENTRIES) {
+            unlinkat(dirfd(dir), entry->d_name, 0);
+            continue;
+        }
+        if (count == BGCACHE_MAX_ENTRIES) {
+            unlinkat(dirfd(dir), names[count - 1], 0);
+            free(names[count - 1]);
+            count--;
+        }
+        memmove(&names[pos + 1], &names[pos], (count - pos) * sizeof(char *));
+        memmove(&mtimes[pos + 1], &mtimes[pos], (count - pos) * sizeof(time_t));
+        names[pos] = strdup(entry->d_name);
+        mtimes[pos] = st.st_mtime;
+        count++;
+    }
+
+    for (int i = 0; i < count; i++)
+        free(names[i]);
+    closedir(dir);
+}
+
+/*
+ * Writes the given rendered background (a CAIRO_FORMAT_RGB24 image surface) to
+ * the cache. The file is written under a temporary name and renamed when
+ * complete, so that a concurrently locking i3lock never maps a partial file.
+ *
+ */
+void bgcache_store(cairo_surface_t *background, uint32_t *resolution) {
+    if (!bgcache_active())
+        return;
+
+    cairo_surface_flush(background);
+    const uint32_t width = cairo_image_surface_get_width(background);
+    const uint32_t height = cairo_image_surface_get_height(background);
+    const uint32_t stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, width);
+    const unsigned char *data = cairo_image_surface_get_data(background);
+    const int src_stride = cairo_image_surface_get_stride(background);
+    if (cairo_image_surface_get_format(background) != CAIRO_FORMAT_RGB24 ||
+        width != resolution[0] || height != resolution[1])
+        return;
+
+    struct bgcache_header header = {
+        .magic = BGCACHE_MAGIC,
+        .key = background_key(resolution),
+        .width = width,
+        .height = height,
+        .stride = stride,
+        .data_offset = sysconf(_SC_PAGESIZE),
+    };
+
+    char *path = cache_path(header.key);
+    char *tmp_path;
+    if (path == NULL)
+        return;
+    if (asprintf(&tmp_path, "%s.%d.tmp", path, getpid()) == -1) {
+        free(path);
+        return;
+    }
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    bool ok = (fd != -1);
+    if (ok)
+        ok = (pwrite(fd, &header, sizeof(header), 0) == sizeof(header));
+    for (uint32_t y = 0; ok && y < height; y++)
+        ok = (pwrite(fd, data + y * src_stride, stride, header.data_offset + (off_t)y * stride) == (ssize_t)stride);
+    if (fd != -1 && close(fd) != 0)
+        ok = false;
+
+    if (ok && rename(tmp_path, path) == 0) {
+        DEBUG("stored background %016" PRIx64 " in the cache\n", header.key);
+        prune_cache();
+    } else {
+        DEBUG("could not write cached background \"%s\": %s\n", path, strerror(errno));
+        unlink(tmp_path);
+    }
+
+    free(tmp_path);
+    free(path);
+}
@@ -0,0 +1,14 @@
+#ifndef _BGCACHE_H
+#define _BGCACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <cairo.h>
+
+void bgcache_init(const char *image_path);
+bool bgcache_active(void);
+bool bgcache_contains(uint32_t *resolution);
+cairo_surface_t *bgcache_load(uint32_t *resolution);
+void bgcache_store(cairo_surface_t *background, uint32_t *resolution);
+
+#endif
@@ -0,0 +1,345 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * blur.c: approximates a gaussian blur with three box blurs in each
+ *         direction, split across the thread pool. Stronger blurs are done on a
+ *         downscaled copy of the image, which looks the same but is a lot
+ *         faster. The inner loops are plain C for the auto-vectorizer, the
+ *         Makefile builds this file with -O2 -ftree-vectorize for that.
+ *
+ * See LICENSE for licensing information
+ *
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <err.h>
+
+#include "blur.h"
+#include "threadpool.h"
+
+/* Upper bound for the number of parts to split the work into. */
+#define MAX_BLUR_JOBS 16
+
+/* The image is downscaled so that the remaining blur has a standard deviation
+ * of at least this many pixels, by a factor of at most MAX_DOWNSCALE. */
+#define MIN_SCALED_SIGMA 3
+#define MAX_DOWNSCALE 4
+
+/* An image with 4 bytes per pixel. */
+typedef struct image {
+    uint8_t *data;
+    int width;
+    int height;
+    int stride;
+} image_t;
+
+/* The part of the work one thread does: rows [start, end) of the output for
+ * the scaling and horizontal passes, columns [start, end) for the vertical
+ * passes. */
+typedef struct blur_job {
+    image_t *full;
+    image_t *scaled;
+    /* Scratch space of the size of scaled. */
+    uint8_t *tmp;
+    int factor;
+    int radius;
+    /* 65536 / (2 * radius + 1), to divide by the box size with a shift. It is
+     * rounded down, so that the result never exceeds 255. */
+    uint32_t mul;
+    int start;
+    int end;
+} blur_job_t;
+
+static inline int clamp(int value, int min, int max) {
+    return (value < min ? min : (value > max ? max : value));
+}
+
+/*
+ * Averages factor × factor blocks of the full image into the scaled one. The
+ * rows of a block are summed up first, so that the inner loop vectorizes (with
+ * -O2 -ftree-vectorize, see the Makefile).
+ *
+ */
+static void *downscale(void *arg) {
+    blur_job_t *job = arg;
+    const image_t *full = job->full;
+    const image_t *scaled = job->scaled;
+    const int f = job->factor;
+    /* 65536 / f², rounded up, to divide with a shift. */
+    const uint32_t mul = (65536 + f * f - 1) / (f * f);
+    const int bytes = 4 * full->width;
+
+    uint16_t *rows = malloc(bytes * sizeof(uint16_t));
+    if (!rows)
+        err(EXIT_FAILURE, "Could not allocate memory for blurring");
+
+    for (int y = job->start; y < job->end; y++) {
+        memset(rows, 0, bytes * sizeof(uint16_t));
+        for (int dy = 0; dy < f; dy++) {
+            const uint8_t *in = full->data + clamp(y * f + dy, 0, full->height - 1) * full->stride;
+            for (int j = 0; j < bytes; j++)
+                rows[j] += in[j];
+        }
+
+        uint8_t *out = scaled->data + y * scaled->stride;
+        for (int x = 0; x < scaled->width; x++) {
+            uint32_t sum[4] = {0, 0, 0, 0};
+            for (int dx = 0; dx < f; dx++) {
+                const uint16_t *pixel = rows + 4 * clamp(x * f + dx, 0, full->width - 1);
+                for (int c = 0; c < 4; c++)
+                    sum[c] += pixel[c];
+            }
+            for (int c = 0; c < 4; c++)
+                out[4 * x + c] = (sum[c] * mul) >> 16;
+        }
+    }
+
+    free(rows);
+    return NULL;
+}
+
+/*
+ * Interpolates between two pixels, weight is between 0 (a) and 256 (b). Two
+ * channels are handled at once in the 16 bit halves of a 32 bit integer.
+ *
+ */
+static inline uint32_t lerp_pixel(uint32_t a, uint32_t b, uint32_t weight) {
+    const uint32_t mask = 0x00ff00ff;
+    uint32_t even = (((a & mask) * (256 - weight) + (b & mask) * weight) >> 8) & mask;
+    uint32_t odd = ((((a >> 8) & mask) * (256 - weight) + ((b >> 8) & mask) * weight) >> 8) & mask;
+    return even | (odd << 8);
+}
+
+static inline uint32_t load_pixel(const uint8_t *p) {
+    uint32_t pixel;
+    memcpy(&pixel, p, sizeof(pixel));
+    return pixel;
+}
+
+/*
+ * Scales the scaled image back up into the full one with bilinear
+ * interpolation: every output row is interpolated vertically from two rows of
+ * the scaled image first, and then horizontally.
+ *
+ */
+static void *upscale(void *arg) {
+    blur_job_t *job = arg;
+    const image_t *full = job->full;
+    const image_t *scaled = job->scaled;
+    const int f = job->factor;
+
+    /* The horizontal source pixels and weights are the same for every row. */
+    int *left = malloc(full->width * sizeof(int));
+    uint32_t *weights = malloc(full->width * sizeof(uint32_t));
+    uint32_t *row = malloc((scaled->width + 1) * sizeof(uint32_t));
+    if (!left || !weights || !row)
+        err(EXIT_FAILURE, "Could not allocate memory for blurring");
+
+    for (int x = 0; x < full->width; x++) {
+        /* The center of the output pixel, in scaled coordinates × 256. */
+        int sx = ((2 * x + 1) * 256) / (2 * f) - 128;
+        left[x] = clamp(sx >> 8, 0, scaled->width - 1);
+        weights[x] = (sx < 0 ? 0 : sx & 0xff);
+    }
+
+    for (int y = job->start; y < job->end; y++) {
+        int sy = ((2 * y + 1) * 256) / (2 * f) - 128;
+        int y0 = clamp(sy >> 8, 0, scaled->height - 1);
+        int y1 = clamp((sy >> 8) + 1, 0, scaled->height - 1);
+        uint32_t wy = (sy < 0 ? 0 : sy & 0xff);
+        const uint8_t *row0 = scaled->data + y0 * scaled->stride;
+        const uint8_t *row1 = scaled->data + y1 * scaled->stride;
+
+        for (int x = 0; x < scaled->width; x++)
+            row[x] = lerp_pixel(load_pixel(row0 + 4 * x), load_pixel(row1 + 4 * x), wy);
+        /* Repeat the last pixel, so that the right edge needs no check. */
+        row[scaled->width] = row[scaled->width - 1];
+
+        uint8_t *out = full->data + y * full->stride;
+        for (int x = 0; x < full->width; x++) {
+            uint32_t pixel = lerp_pixel(row[left[x]], row[left[x] + 1], weights[x]);
+            memcpy(out + 4 * x, &pixel, sizeof(pixel));
+        }
+    }
+
+    free(left);
+    free(weights);
+    free(row);
+    return NULL;
+}
+
+/*
+ * Box-blurs one row of n pixels (4 bytes each) from src into dst, keeping a
+ * running sum per channel.
+ *
+ */
+static void blur_row(const uint8_t *src, uint8_t *dst, int n, int radius, uint32_t mul) {
+    uint32_t sum[4] = {0, 0, 0, 0};
+
+    for (int i = -radius; i <= radius; i++) {
+        const uint8_t *pixel = src + 4 * clamp(i, 0, n - 1);
+        for (int c = 0; c < 4; c++)
+            sum[c] += pixel[c];
+    }
+
+    for (int x = 0; x < n; x++) {
+        const uint8_t *add = src + 4 * clamp(x + radius + 1, 0, n - 1);
+        const uint8_t *sub = src + 4 * clamp(x - radius, 0, n - 1);
+        for (int c = 0; c < 4; c++) {
+            dst[4 * x + c] = (sum[c] * mul + 32768) >> 16;
+            sum[c] += add[c] - sub[c];
+        }
+    }
+}
+
+/*
+ * Box-blurs the columns [start, end) of src into dst. Works on whole row
+ * segments at a time (with one running sum per byte in sums), so that the
+ * memory is accessed sequentially and the inner loops vectorize (with -O2
+ * -ftree-vectorize, see the Makefile).
+ *
+ */
+static void blur_columns(const uint8_t *src, uint8_t *dst, const blur_job_t *job, uint32_t *sums) {
+    const image_t *img = job->scaled;
+    const int bytes = 4 * (job->end - job->start);
+    const int offset = 4 * job->start;
+
+    memset(sums, 0, bytes * sizeof(uint32_t));
+    for (int i = -job->radius; i <= job->radius; i++) {
+        const uint8_t *row = src + clamp(i, 0, img->height - 1) * img->stride + offset;
+        for (int j = 0; j < bytes; j++)
+            sums[j] += row[j];
+    }
+
+    for (int y = 0; y < img->height; y++) {
+        uint8_t *out = dst + y * img->stride + offset;
+        const uint8_t *add = src + clamp(y + job->radius + 1, 0, img->height - 1) * img->stride + offset;
+        const uint8_t *sub = src + clamp(y - job->radius, 0, img->height - 1) * img->stride + offset;
+        for (int j = 0; j < bytes; j++) {
+            out[j] = (sums[j] * job->mul + 32768) >> 16;
+            sums[j] += add[j] - sub[j];
+        }
+    }
+}
+
+static void *blur_horizontally(void *arg) {
+    blur_job_t *job = arg;
+    const image_t *img = job->scaled;
+
+    /* Each row is blurred three times, using its part of tmp as scratch. */
+    for (int y = job->start; y < job->end; y++) {
+        uint8_t *row = img->data + y * img->stride;
+        uint8_t *scratch = job->tmp + y * img->stride;
+        blur_row(row, scratch, img->width, job->radius, job->mul);
+        blur_row(scratch, row, img->width, job->radius, job->mul);
+        blur_row(row, scratch, img->width, job->radius, job->mul);
+        memcpy(row, scratch, 4 * img->width);
+    }
+    return NULL;
+}
+
+static void *blur_vertically(void *arg) {
+    blur_job_t *job = arg;
+    const image_t *img = job->scaled;
+    uint32_t *sums = malloc(4 * (job->end - job->start) * sizeof(uint32_t));
+    if (!sums)
+        err(EXIT_FAILURE, "Could not allocate memory for blurring");
+
+    blur_columns(img->data, job->tmp, job, sums);
+    blur_columns(job->tmp, img->data, job, sums);
+    blur_columns(img->data, job->tmp, job, sums);
+    for (int y = 0; y < img->height; y++)
+        memcpy(img->data + y * img->stride + 4 * job->start,
+               job->tmp + y * img->stride + 4 * job->start,
+               4 * (job->end - job->start));
+
+    free(sums);
+    return NULL;
+}
+
+/* One pass of the blur, run on the thread pool by run_jobs(). */
+typedef struct blur_pass {
+    void *(*worker)(void *);
+    blur_job_t *jobs;
+} blur_pass_t;
+
+static void run_job(void *arg, int index) {
+    blur_pass_t *pass = arg;
+    pass->worker(&pass->jobs[index]);
+}
+
+/*
+ * Splits [0, total) into count parts and runs worker once for every part, in
+ * parallel.
+ *
+ */
+static void run_jobs(void *(*worker)(void *), blur_job_t *jobs, int count, int total) {
+    for (int i = 0; i < count; i++) {
+        jobs[i].start = (int)((long)total * i / count);
+        jobs[i].end = (int)((long)total * (i + 1) / count);
+    }
+    blur_pass_t pass = {worker, jobs};
+    threadpool_run(run_job, &pass, count);
+}
+
+/*
+ * Blurs the given image (4 bytes per pixel, e.g. a cairo RGB24 or ARGB32
+ * surface) in place. Three successive box blurs approximate a gaussian blur
+ * with the given standard deviation (in pixels).
+ *
+ */
+void blur_image(uint8_t *data, int width, int height, int stride, int sigma) {
+    if (sigma < 1 || width < 1 || height < 1)
+        return;
+
+    image_t full = {data, width, height, stride};
+    image_t scaled = full;
+    int factor = clamp(sigma / MIN_SCALED_SIGMA, 1, MAX_DOWNSCALE);
+    if (factor > 1) {
+        scaled.width = (width + factor - 1) / factor;
+        scaled.height = (height + factor - 1) / factor;
+        scaled.stride = 4 * scaled.width;
+        if (!(scaled.data = malloc((size_t)scaled.stride * scaled.height)))
+            err(EXIT_FAILURE, "Could not allocate memory for blurring");
+    }
+
+    /* Box width for three passes: w = sqrt(12 σ² / 3 + 1), see
+     * https://www.peterkovesi.com/papers/FastGaussianSmoothing.pdf */
+    double scaled_sigma = (double)sigma / factor;
+    int radius = (int)round((sqrt(4.0 * scaled_sigma * scaled_sigma + 1.0) - 1.0) / 2.0);
+
+    uint8_t *tmp = malloc((size_t)scaled.stride * scaled.height);
+    if (!tmp)
+        err(EXIT_FAILURE, "Could not allocate memory for blurring");
+
+    int count = clamp(threadpool_size(), 1, MAX_BLUR_JOBS);
+    blur_job_t jobs[MAX_BLUR_JOBS];
+
+    for (int i = 0; i < count; i++)
+        jobs[i] = (blur_job_t){
+            .full = &full,
+            .scaled = &scaled,
+            .tmp = tmp,
+            .factor = factor,
+            .radius = radius,
+            .mul = 65536 / (2 * radius + 1),
+        };
+
+    if (factor > 1)
+        run_jobs(downscale, jobs, count, scaled.height);
+    if (radius > 0) {
+        run_jobs(blur_horizontally, jobs, count, scaled.height);
+        run_jobs(blur_vertically, jobs, count, scaled.width);
+    }
+    if (factor > 1) {
+        run_jobs(upscale, jobs, count, height);
+        free(scaled.data);
+    }
+
+    free(tmp);
+}
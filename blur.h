@@ -0,0 +1,8 @@
+#ifndef _BLUR_H
+#define _BLUR_H
+
+#include <stdint.h>
+
+void blur_image(uint8_t *data, int width, int height, int stride, int sigma);
+
+#endif
@@ -0,0 +1,188 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * daemon.c: the control socket of the lock daemon (--daemon). Clients send one
+ *           command per line and get one line back: "lock" locks the screen
+ *           and replies "locked" once pointer and keyboard are grabbed (or
+ *           "error"), "status" replies "locked" or "unlocked".
+ *
+ * See LICENSE for licensing information
+ *
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <ev.h>
+
+#include "i3lock.h"
+#include "daemon.h"
+
+extern bool debug_mode;
+extern struct ev_loop *main_loop;
+
+/* Commands are short, anything longer than this is not a command. */
+#define MAX_COMMAND_LENGTH 64
+
+struct client {
+    ev_io watcher;
+    char buffer[MAX_COMMAND_LENGTH];
+    size_t length;
+};
+
+static char *socket_path;
+static int listen_fd = -1;
+static ev_io listen_watcher;
+static bool (*lock_callback)(void);
+static bool (*is_locked_callback)(void);
+
+/*
+ * Returns the default path of the control socket, in $XDG_RUNTIME_DIR if
+ * possible. The caller needs to free it.
+ *
+ */
+char *daemon_default_socket_path(void) {
+    char *path;
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    int ret;
+
+    if (runtime_dir != NULL && runtime_dir[0] == '/')
+        ret = asprintf(&path, "%s/i3lock-color.sock", runtime_dir);
+    else
+        ret = asprintf(&path, "/tmp/i3lock-color-%d.sock", getuid());
+    if (ret == -1)
+        err(EXIT_FAILURE, "asprintf()");
+    return path;
+}
+
+static void close_client(struct client *client) {
+    ev_io_stop(main_loop, &client->watcher);
+    close(client->watcher.fd);
+    free(client);
+}
+
+/*
+ * Executes the given command and returns the reply.
+ *
+ */
+static const char *handle_command(const char *command) {
+    DEBUG("daemon command \"%s\"\n", command);
+
+    if (strcmp(command, "lock") == 0)
+        return (lock_callback() ? "locked\n" : "error\n");
+    if (strcmp(command, "status") == 0)
+        return (is_locked_callback() ? "locked\n" : "unlocked\n");
+    return "unknown command\n";
+}
+
+static void client_cb(EV_P_ ev_io *w, int revents) {
+    struct client *client = (struct client *)w;
+
+    ssize_t n = read(w->fd, client->buffer + client->length, sizeof(client->buffer) - client->length);
+    if (n == -1 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n <= 0) {
+        close_client(client);
+        return;
+    }
+    client->length += n;
+
+    char *newline;
+    while ((newline = memchr(client->buffer, '\n', client->length)) != NULL) {
+        *newline = '\0';
+        const char *reply = handle_command(client->buffer);
+        /* The reply is tiny, it fits into the socket buffer. */
+        if (write(w->fd, reply, strlen(reply)) == -1) {
+            close_client(client);
+            return;
+        }
+
+        client->length -= (newline + 1 - client->buffer);
+        memmove(client->buffer, newline + 1, client->length);
+    }
+
+    if (client->length == sizeof(client->buffer)) {
+        DEBUG("daemon command too long, closing connection\n");
+        close_client(client);
+    }
+}
+
+static void listen_cb(EV_P_ ev_io *w, int revents) {
+    int fd = accept(w->fd, NULL, NULL);
+    if (fd == -1)
+        return;
+
+    struct client *client = calloc(1, sizeof(struct client));
+    if (client == NULL) {
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    ev_io_init(&client->watcher, client_cb, fd, EV_READ);
+    ev_io_start(main_loop, &client->watcher);
+}
+
+/*
+ * Creates the control socket at the given path and handles commands in the
+ * main loop. lock() is called to lock the screen and returns whether that
+ * succeeded, is_locked() returns whether the screen is currently locked.
+ *
+ * Exits if the socket cannot be created, or another daemon already listens.
+ *
+ */
+void daemon_listen(const char *path, bool (*lock)(void), bool (*is_locked)(void)) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path))
+        errx(EXIT_FAILURE, "Socket path \"%s\" is too long", path);
+    strcpy(addr.sun_path, path);
+
+    if ((listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+        err(EXIT_FAILURE, "socket()");
+
+    /* A socket which nobody listens on is left over from a crashed daemon. */
+    if (connect(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+        errx(EXIT_FAILURE, "Another i3lock daemon is already listening on \"%s\"", path);
+    close(listen_fd);
+    unlink(path);
+
+    if ((listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) == -1)
+        err(EXIT_FAILURE, "socket()");
+
+    /* Only the user running i3lock may connect. */
+    mode_t old_umask = umask(0077);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+        err(EXIT_FAILURE, "Could not bind to \"%s\"", path);
+    umask(old_umask);
+
+    if (listen(listen_fd, 4) != 0)
+        err(EXIT_FAILURE, "listen()");
+
+    socket_path = strdup(path);
+    lock_callback = lock;
+    is_locked_callback = is_locked;
+
+    ev_io_init(&listen_watcher, listen_cb, listen_fd, EV_READ);
+    ev_io_start(main_loop, &listen_watcher);
+    DEBUG("listening for commands on \"%s\"\n", path);
+}
+
+/*
+ * Removes the control socket.
+ *
+ */
+void daemon_cleanup(void) {
+    if (socket_path == NULL)
+        return;
+    close(listen_fd);
+    unlink(socket_path);
+}
@@ -0,0 +1,10 @@
+#ifndef _DAEMON_H
+#define _DAEMON_H
+
+#include <stdbool.h>
+
+char *daemon_default_socket_path(void);
+void daemon_listen(const char *path, bool (*lock)(void), bool (*is_locked)(void));
+void daemon_cleanup(void);
+
+#endif
@@ -10,12 +10,19 @@
 #include <stdlib.h>
 #include <pwd.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <xcb/xcb.h>
 #include <xcb/xkb.h>
+#include <xcb/xinerama.h>
+#include <xcb/randr.h>
+#include <xcb/shm.h>
+#include <xcb/present.h>
+#include <xcb/xfixes.h>
 #include <err.h>
 #include <assert.h>
 #include <security/pam_appl.h>
@@ -23,6 +30,9 @@
 #include <string.h>
 #include <ev.h>
 #include <sys/mman.h>
+#include <pthread.h>
+#include <time.h>
+#include <signal.h>
 #include <xkbcommon/xkbcommon.h>
 #include <xkbcommon/xkbcommon-compose.h>
 #include <xkbcommon/xkbcommon-x11.h>
@@ -34,13 +44,28 @@
 #include "cursors.h"
 #include "unlock_indicator.h"
 #include "xinerama.h"
+#include "randr.h"
+#include "theme.h"
+#include "stats.h"
+#include "blur.h"
+#include "image.h"
+#include "bgcache.h"
+#include "daemon.h"
+#include "present.h"
+#include "anim.h"
+#include "power.h"
+#include "input.h"
+
+/* The last keysym of the range reserved for dead keys, which starts with
+ * XKB_KEY_dead_grave. */
+#define XKB_KEY_DEAD_KEYS_END 0xfe9f
 
 #define TSTAMP_N_SECS(n) (n * 1.0)
 #define TSTAMP_N_MINS(n) (60 * TSTAMP_N_SECS(n))
 #define START_TIMER(timer_obj, timeout, callback) \
-    timer_obj = start_timer(timer_obj, timeout, callback)
+    start_timer(&(timer_obj), timeout, callback)
 #define STOP_TIMER(timer_obj) \
-    timer_obj = stop_timer(timer_obj)
+    stop_timer(&(timer_obj))
 
 typedef void (*ev_callback_t)(EV_P_ ev_timer *w, int revents);
 
@@ -69,19 +94,95 @@ xcb_window_t win;
 static xcb_cursor_t cursor;
 static pam_handle_t *pam_handle;
 int input_position = 0;
-/* Holds the password you enter (in UTF-8). */
-static char password[512];
+/* Holds the password you enter. input_position is its length. */
+static input_buffer_t password;
+/* Holds the password which is currently being verified. It is handed over
+ * from password when authentication starts, so that keys typed in the
+ * meantime already go into the buffer for the next attempt. */
+static input_buffer_t auth_password;
 static bool beep = false;
 bool debug_mode = false;
+/* Whether to report how long each phase of the startup takes (--timing). */
+static bool timing_mode = false;
+static struct timespec timing_start;
+static struct timespec timing_last;
+static unsigned int timing_round_trips;
 bool unlock_indicator = true;
 char *modifier_string = NULL;
+/* The label of the modifiers which were active when the password turned out
+ * to be wrong, modifier_string points here while it is shown. */
+static char wrong_modifiers[MODIFIER_LABEL_SIZE];
 static bool dont_fork = false;
+/* The pipe to tell the parent process that the window is mapped, see
+ * fork_into_background(). -1 if there is no parent waiting. */
+static int mapped_fd = -1;
+/* Whether to free the client-side copy of the image once it is uploaded
+ * (--low-memory). */
+static bool low_memory = false;
+/* Whether to draw the unlock indicator with core X11 requests
+ * (--core-indicator), see draw_indicator_core(). */
+bool core_indicator = false;
+/* The font family for the text of the unlock indicator (--font). */
+char *font_name = NULL;
+/* Whether to stay resident and lock on request, see lock_screen() (--daemon). */
+static bool daemon_mode = false;
+static char *daemon_socket_path = NULL;
+/* Whether the screen is currently locked. Always true without --daemon. */
+static bool locked = true;
+/* When the current lock was requested, for STAT_MAPPED in daemon mode. */
+static double lock_start;
 struct ev_loop *main_loop;
-static struct ev_timer *clear_pam_wrong_timeout;
-static struct ev_timer *clear_indicator_timeout;
-static struct ev_timer *discard_passwd_timeout;
+/* All timers are allocated statically and only rescheduled, see
+ * start_timer(). */
+static struct ev_timer clear_pam_wrong_timeout;
+static struct ev_timer clear_indicator_timeout;
+static struct ev_timer discard_passwd_timeout;
+static struct ev_timer clear_highlight_timeout;
+/* Whether rendering is suspended, see update_power_state(). */
+static bool monitors_blanked;
+/* PAM authentication runs in auth_thread, which signals auth_done_watcher
+ * with the result in auth_result, so that the main loop does not block. */
+static pthread_t auth_thread;
+static bool auth_thread_started;
+static int auth_result;
+static double auth_duration;
+static struct ev_async auth_done_watcher;
+/* The image (-i) is decoded (or the screenshot for --blur is blurred) in
+ * decode_thread while the window is already shown with the background color.
+ * decode_done_watcher is signaled once decoded_img is ready. */
+static pthread_t decode_thread;
+static bool decode_thread_started;
+static bool decode_pending;
+static const char *decoded_path;
+/* The image only needs to be decoded at this size (0 means full size), see
+ * image_decode_size(). */
+static int decoded_min_width;
+static int decoded_min_height;
+static cairo_surface_t *decoded_img;
+static struct ev_async decode_done_watcher;
+/* Standard deviation (in pixels) to blur the screenshot with, 0 if --blur was
+ * not given. */
+static int blur_sigma = 0;
+/* The share (in percent of one CPU core) which animation frames may take,
+ * 0 disables animations (--anim-budget). */
+static int anim_budget = 5;
+/* Dumps the statistics (--stats) on SIGUSR1. */
+static struct ev_signal stats_signal_watcher;
+/* Lock on SIGUSR2, clean up on SIGTERM/SIGINT (--daemon). */
+static struct ev_signal lock_signal_watcher;
+static struct ev_signal term_signal_watcher;
+static struct ev_signal int_signal_watcher;
 extern unlock_state_t unlock_state;
 extern pam_state_t pam_state;
+/* Key presses are handled in batches (all events read at once, e.g. when a
+ * password manager types via XTEST): handle_key_press() only updates the
+ * password buffer and records the feedback to give, finish_key_batch() then
+ * highlights the unlock indicator and (re)starts the timers once per batch. */
+static unlock_state_t batch_feedback = STATE_STARTED;
+static bool batch_typed = false;
+/* Set when the root window or the monitors changed in the current batch of
+ * events, so that storms of RandR events cause only one update. */
+static bool screen_changed = false;
 int failed_attempts = 0;
 bool show_failed_attempts = false;
 
@@ -90,23 +191,64 @@ static struct xkb_context *xkb_context;
 static struct xkb_keymap *xkb_keymap;
 static struct xkb_compose_table *xkb_compose_table;
 static struct xkb_compose_state *xkb_compose_state;
+/* The locale to load the compose table for, see load_compose_table_lazily(). */
+static const char *compose_locale;
 static uint8_t xkb_base_event;
+/* The core keyboard, see keyboard_device(). */
+static int32_t keyboard_device_id = -1;
+/* The size of the root window as of its last ConfigureNotify, which
+ * handle_screen_resize() applies. */
+static uint16_t root_size[2];
 static uint8_t xkb_base_error;
 
 cairo_surface_t *img = NULL;
 bool tile = false;
+image_mode_t image_mode = IMAGE_MODE_NONE;
 bool ignore_empty_password = false;
 bool skip_repeated_empty_password = false;
 
-/* isutf, u8_dec © 2005 Jeff Bezanson, public domain */
-#define isutf(c) (((c)&0xC0) != 0x80)
+/*
+ * Returns the number of milliseconds between two points in time.
+ *
+ */
+static double elapsed_ms(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000.0 +
+           (to->tv_nsec - from->tv_nsec) / 1000000.0;
+}
 
 /*
- * Decrements i to point to the previous unicode glyph
+ * Reports that the given phase of the startup is done, with the time since
+ * i3lock started and since the previous phase, and the number of round trips
+ * to the X server in that phase. Only active with --timing.
  *
  */
-void u8_dec(char *s, int *i) {
-    (void)(isutf(s[--(*i)]) || isutf(s[--(*i)]) || isutf(s[--(*i)]) || --(*i));
+void report_timing(const char *phase) {
+    if (!timing_mode)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    unsigned int round_trips = stats_round_trips();
+    fprintf(stderr, "[i3lock-timing] %-24s %9.3f ms (+%.3f ms, +%u round trips)\n",
+            phase, elapsed_ms(&timing_start, &now), elapsed_ms(&timing_last, &now),
+            round_trips - timing_round_trips);
+    timing_last = now;
+    timing_round_trips = round_trips;
+}
+
+/*
+ * Returns the device id of the core keyboard. Asking for it is a round trip,
+ * so it is only done once: the core keyboard is a master device, which keeps
+ * its id when a different physical keyboard is plugged in.
+ *
+ */
+static int32_t keyboard_device(void) {
+    if (keyboard_device_id == -1) {
+        stats_round_trip_start();
+        keyboard_device_id = xkb_x11_get_core_keyboard_device_id(conn);
+        stats_round_trip_done(ROUND_TRIP_SITE, NULL);
+    }
+    return keyboard_device_id;
 }
 
 /*
@@ -125,15 +267,22 @@ static bool load_keymap(void) {
 
     xkb_keymap_unref(xkb_keymap);
 
-    int32_t device_id = xkb_x11_get_core_keyboard_device_id(conn);
+    int32_t device_id = keyboard_device();
     DEBUG("device = %d\n", device_id);
-    if ((xkb_keymap = xkb_x11_keymap_new_from_device(xkb_context, conn, device_id, 0)) == NULL) {
+    /* libxkbcommon sends all requests for the keymap at once, but waits for
+     * their replies before returning. */
+    stats_round_trip_start();
+    xkb_keymap = xkb_x11_keymap_new_from_device(xkb_context, conn, device_id, 0);
+    stats_round_trip_done(ROUND_TRIP_SITE, NULL);
+    if (xkb_keymap == NULL) {
         fprintf(stderr, "[i3lock] xkb_x11_keymap_new_from_device failed\n");
         return false;
     }
 
+    stats_round_trip_start();
     struct xkb_state *new_state =
         xkb_x11_state_new_from_device(xkb_keymap, conn, device_id);
+    stats_round_trip_done(ROUND_TRIP_SITE, NULL);
     if (new_state == NULL) {
         fprintf(stderr, "[i3lock] xkb_x11_state_new_from_device failed\n");
         return false;
@@ -142,6 +291,9 @@ static bool load_keymap(void) {
     xkb_state_unref(xkb_state);
     xkb_state = new_state;
 
+    input_keymap_changed();
+    input_update_modifiers(xkb_keymap, xkb_state);
+
     return true;
 }
 
@@ -170,45 +322,43 @@ static bool load_compose_table(const char *locale) {
 }
 
 /*
- * Clears the memory which stored the password to be a bit safer against
- * cold-boot attacks.
+ * Parsing the compose table takes a while and most passwords never need it, so
+ * it is only loaded when the first key which can start a compose sequence (a
+ * dead key or Multi_key) is pressed.
  *
  */
-static void clear_password_memory(void) {
-    /* A volatile pointer to the password buffer to prevent the compiler from
-     * optimizing this out. */
-    volatile char *vpassword = password;
-    for (int c = 0; c < sizeof(password); c++)
-        /* We store a non-random pattern which consists of the (irrelevant)
-         * index plus (!) the value of the beep variable. This prevents the
-         * compiler from optimizing the calls away, since the value of 'beep'
-         * is not known at compile-time. */
-        vpassword[c] = c + (int)beep;
+static void load_compose_table_lazily(xkb_keysym_t ksym) {
+    static bool tried = false;
+
+    if (tried || xkb_compose_state != NULL || compose_locale == NULL)
+        return;
+    if (ksym != XKB_KEY_Multi_key &&
+        (ksym < XKB_KEY_dead_grave || ksym > XKB_KEY_DEAD_KEYS_END))
+        return;
+
+    tried = true;
+    double start = stats_now();
+    load_compose_table(compose_locale);
+    DEBUG("loaded compose table for %s in %.3f ms\n", compose_locale, stats_now() - start);
 }
 
-ev_timer *start_timer(ev_timer *timer_obj, ev_tstamp timeout, ev_callback_t callback) {
-    if (timer_obj) {
-        ev_timer_stop(main_loop, timer_obj);
-        ev_timer_set(timer_obj, timeout, 0.);
-        ev_timer_start(main_loop, timer_obj);
-    } else {
-        /* When there is no memory, we just don’t have a timeout. We cannot
-         * exit() here, since that would effectively unlock the screen. */
-        timer_obj = calloc(sizeof(struct ev_timer), 1);
-        if (timer_obj) {
-            ev_timer_init(timer_obj, callback, timeout, 0.);
-            ev_timer_start(main_loop, timer_obj);
-        }
-    }
-    return timer_obj;
+/*
+ * (Re)starts the given timer as a one-shot timer. Since the timers are not
+ * allocated dynamically and an active timer is merely rescheduled, this is
+ * cheap enough to be called on every key press.
+ *
+ */
+static void start_timer(ev_timer *timer_obj, ev_tstamp timeout, ev_callback_t callback) {
+    if (!ev_is_active(timer_obj))
+        ev_init(timer_obj, callback);
+    /* ev_timer_again() uses the repeat value as timeout. The callbacks stop
+     * their timer, so it does not actually repeat. */
+    timer_obj->repeat = timeout;
+    ev_timer_again(main_loop, timer_obj);
 }
 
-ev_timer *stop_timer(ev_timer *timer_obj) {
-    if (timer_obj) {
-        ev_timer_stop(main_loop, timer_obj);
-        free(timer_obj);
-    }
-    return NULL;
+static void stop_timer(ev_timer *timer_obj) {
+    ev_timer_stop(main_loop, timer_obj);
 }
 
 /*
@@ -219,15 +369,12 @@ ev_timer *stop_timer(ev_timer *timer_obj) {
 static void clear_pam_wrong(EV_P_ ev_timer *w, int revents) {
     DEBUG("clearing pam wrong\n");
     pam_state = STATE_PAM_IDLE;
-    redraw_screen();
+    schedule_redraw();
 
     /* Clear modifier string. */
-    if (modifier_string != NULL) {
-        free(modifier_string);
-        modifier_string = NULL;
-    }
+    modifier_string = NULL;
 
-    /* Now free this timeout. */
+    /* Now stop this timeout. */
     STOP_TIMER(clear_pam_wrong_timeout);
 }
 
@@ -237,9 +384,8 @@ static void clear_indicator_cb(EV_P_ ev_timer *w, int revents) {
 }
 
 static void clear_input(void) {
+    input_clear(&password);
     input_position = 0;
-    clear_password_memory();
-    password[input_position] = '\0';
 }
 
 static void discard_passwd_cb(EV_P_ ev_timer *w, int revents) {
@@ -247,74 +393,184 @@ static void discard_passwd_cb(EV_P_ ev_timer *w, int revents) {
     STOP_TIMER(discard_passwd_timeout);
 }
 
+/*
+ * Runs in a separate thread, so that the main loop keeps handling X11 events
+ * (and redrawing) while PAM takes its time.
+ *
+ */
+static void *authenticate(void *arg) {
+    double start = stats_now();
+    auth_result = pam_authenticate(pam_handle, 0);
+    auth_duration = stats_now() - start;
+    ev_async_send(main_loop, &auth_done_watcher);
+    return NULL;
+}
+
 static void input_done(void) {
     STOP_TIMER(clear_pam_wrong_timeout);
     pam_state = STATE_PAM_VERIFY;
     unlock_state = STATE_STARTED;
+    schedule_redraw();
+
+    /* Hand the password over to the authentication thread. Keys typed while
+     * it is being verified are queued up in password for the next attempt. */
+    input_move(&auth_password, &password);
+    input_position = 0;
+    /* Keys handled before Enter in the same batch should not be highlighted
+     * while verifying. */
+    batch_feedback = STATE_STARTED;
+
+    auth_thread_started = (pthread_create(&auth_thread, NULL, authenticate, NULL) == 0);
+    if (!auth_thread_started) {
+        /* Better block than not being able to unlock at all. */
+        if (debug_mode)
+            fprintf(stderr, "Could not start authentication thread, verifying synchronously\n");
+        authenticate(NULL);
+    }
+}
+
+/*
+ * Resets everything which is shown on the lock screen, so that nothing of the
+ * previous lock is visible on the next one.
+ *
+ */
+static void reset_lock_state(void) {
+    STOP_TIMER(clear_pam_wrong_timeout);
+    STOP_TIMER(clear_indicator_timeout);
+    STOP_TIMER(discard_passwd_timeout);
+    STOP_TIMER(clear_highlight_timeout);
+
+    clear_input();
+    pam_state = STATE_PAM_IDLE;
+    unlock_state = STATE_STARTED;
+    batch_feedback = STATE_STARTED;
+    skip_repeated_empty_password = false;
+    failed_attempts = 0;
+    modifier_string = NULL;
+    if (xkb_compose_state)
+        xkb_compose_state_reset(xkb_compose_state);
+}
+
+/*
+ * Locks the screen in daemon mode. Everything is already set up and the window
+ * already shows the lock screen, so this only maps the window and grabs
+ * pointer and keyboard.
+ *
+ * Returns false if pointer and keyboard could not be grabbed, in which case
+ * the screen is not locked.
+ *
+ */
+static bool lock_screen(void) {
+    if (locked)
+        return true;
+
+    DEBUG("locking the screen\n");
+    lock_start = stats_now();
+    map_fullscreen_window(conn, win);
+
+    double grab_start = stats_now();
+    if (!grab_pointer_and_keyboard(conn, screen, cursor)) {
+        xcb_unmap_window(conn, win);
+        xcb_flush(conn);
+        return false;
+    }
+    stats_record_since(STAT_GRAB, grab_start);
+    locked = true;
+
+    xcb_flush(conn);
+    return true;
+}
+
+static bool is_locked(void) {
+    return locked;
+}
+
+/*
+ * Unlocks the screen in daemon mode and goes back to standby: the window is
+ * unmapped, and already redrawn for the next lock so that it can be mapped
+ * right away.
+ *
+ */
+static void unlock_screen(void) {
+    DEBUG("unlocking the screen\n");
+    locked = false;
+    xcb_ungrab_pointer(conn, XCB_CURRENT_TIME);
+    xcb_ungrab_keyboard(conn, XCB_CURRENT_TIME);
+    xcb_unmap_window(conn, win);
+
+    reset_lock_state();
     redraw_screen();
+    xcb_flush(conn);
+}
+
+static void lock_signal_cb(EV_P_ ev_signal *w, int revents) {
+    lock_screen();
+}
+
+static void exit_signal_cb(EV_P_ ev_signal *w, int revents) {
+    stats_dump();
+    daemon_cleanup();
+    exit(EXIT_SUCCESS);
+}
+
+/*
+ * Called in the main loop once the authentication thread is done.
+ *
+ */
+static void auth_done_cb(EV_P_ ev_async *w, int revents) {
+    if (auth_thread_started)
+        pthread_join(auth_thread, NULL);
+    input_clear(&auth_password);
+    stats_record(STAT_PAM, auth_duration);
 
-    if (pam_authenticate(pam_handle, 0) == PAM_SUCCESS) {
+    if (auth_result == PAM_SUCCESS) {
         DEBUG("successfully authenticated\n");
-        clear_password_memory();
+        input_clear(&password);
 
         /* PAM credentials should be refreshed, this will for example update any kerberos tickets.
          * Related to credentials pam_end() needs to be called to cleanup any temporary
          * credentials like kerberos /tmp/krb5cc_pam_* files which may of been left behind if the
          * refresh of the credentials failed. */
         pam_setcred(pam_handle, PAM_REFRESH_CRED);
+
+        /* The daemon keeps its PAM handle for the next lock. */
+        if (daemon_mode) {
+            unlock_screen();
+            return;
+        }
         pam_end(pam_handle, PAM_SUCCESS);
 
+        stats_dump();
         exit(0);
     }
 
     if (debug_mode)
         fprintf(stderr, "Authentication failure\n");
 
-    /* Get state of Caps and Num lock modifiers, to be displayed in
-     * STATE_PAM_WRONG state */
-    xkb_mod_index_t idx, num_mods;
-    const char *mod_name;
-
-    num_mods = xkb_keymap_num_mods(xkb_keymap);
-
-    for (idx = 0; idx < num_mods; idx++) {
-        if (!xkb_state_mod_index_is_active(xkb_state, idx, XKB_STATE_MODS_EFFECTIVE))
-            continue;
-
-        mod_name = xkb_keymap_mod_get_name(xkb_keymap, idx);
-        if (mod_name == NULL)
-            continue;
-
-        /* Replace certain xkb names with nicer, human-readable ones. */
-        if (strcmp(mod_name, XKB_MOD_NAME_CAPS) == 0)
-            mod_name = "Caps Lock";
-        else if (strcmp(mod_name, XKB_MOD_NAME_ALT) == 0)
-            mod_name = "Alt";
-        else if (strcmp(mod_name, XKB_MOD_NAME_NUM) == 0)
-            mod_name = "Num Lock";
-        else if (strcmp(mod_name, XKB_MOD_NAME_LOGO) == 0)
-            mod_name = "Win";
-
-        char *tmp;
-        if (modifier_string == NULL) {
-            if (asprintf(&tmp, "%s", mod_name) != -1)
-                modifier_string = tmp;
-        } else if (asprintf(&tmp, "%s, %s", modifier_string, mod_name) != -1) {
-            free(modifier_string);
-            modifier_string = tmp;
-        }
+    /* Show the state of Caps and Num lock modifiers in STATE_PAM_WRONG
+     * state. The label follows the XKB state already, it only needs to be
+     * kept as it is now. */
+    const char *label = input_modifier_label();
+    if (label != NULL) {
+        strcpy(wrong_modifiers, label);
+        modifier_string = wrong_modifiers;
+    } else {
+        modifier_string = NULL;
     }
 
     pam_state = STATE_PAM_WRONG;
     failed_attempts += 1;
-    clear_input();
     if (unlock_indicator)
-        redraw_screen();
+        schedule_redraw();
 
     /* Clear this state after 2 seconds (unless the user enters another
      * password during that time). */
     ev_now_update(main_loop);
     START_TIMER(clear_pam_wrong_timeout, TSTAMP_N_SECS(2), clear_pam_wrong);
+    /* Nobody sees it while the monitors are blanked, see
+     * update_power_state(). */
+    if (monitors_blanked)
+        ev_invoke(main_loop, &clear_pam_wrong_timeout, EV_TIMER);
 
     /* Cancel the clear_indicator_timeout, it would hide the unlock indicator
      * too early. */
@@ -327,9 +583,17 @@ static void input_done(void) {
     }
 }
 
+/*
+ * Removes the highlight of the last key press (or backspace) again.
+ *
+ */
 static void redraw_timeout(EV_P_ ev_timer *w, int revents) {
-    redraw_screen();
-    STOP_TIMER(w);
+    if (unlock_state == STATE_KEY_ACTIVE ||
+        unlock_state == STATE_BACKSPACE_ACTIVE) {
+        unlock_state = STATE_KEY_PRESSED;
+        schedule_redraw();
+    }
+    STOP_TIMER(clear_highlight_timeout);
 }
 
 static bool skip_without_validation(void) {
@@ -345,7 +609,8 @@ static bool skip_without_validation(void) {
 /*
  * Handle key presses. Fixes state, then looks up the key symbol for the
  * given keycode, then looks up the key symbol (as UCS-2), converts it to
- * UTF-8 and stores it in the password array.
+ * UTF-8 and stores it in the password buffer. The visual feedback is given by
+ * finish_key_batch() once all pending key presses have been handled.
  *
  */
 static void handle_key_press(xcb_key_press_event_t *event) {
@@ -358,9 +623,9 @@ static void handle_key_press(xcb_key_press_event_t *event) {
     ksym = xkb_state_key_get_one_sym(xkb_state, event->detail);
     ctrl = xkb_state_mod_name_is_active(xkb_state, XKB_MOD_NAME_CTRL, XKB_STATE_MODS_DEPRESSED);
 
-    /* The buffer will be null-terminated, so n >= 2 for 1 actual character. */
-    memset(buffer, '\0', sizeof(buffer));
-
+    /* Both xkb_keysym_to_utf8() and xkb_compose_state_get_utf8() terminate
+     * the buffer, so n >= 2 for 1 actual character. */
+    load_compose_table_lazily(ksym);
     if (xkb_compose_state && xkb_compose_state_feed(xkb_compose_state, ksym) == XKB_COMPOSE_FEED_ACCEPTED) {
         switch (xkb_compose_state_get_status(xkb_compose_state)) {
             case XKB_COMPOSE_NOTHING:
@@ -388,16 +653,15 @@ static void handle_key_press(xcb_key_press_event_t *event) {
         case XKB_KEY_Return:
         case XKB_KEY_KP_Enter:
         case XKB_KEY_XF86ScreenSaver:
-            if (pam_state == STATE_PAM_WRONG)
+            /* Enter is ignored while the previous password is still being
+             * verified (or was just reported wrong). */
+            if (pam_state == STATE_PAM_VERIFY || pam_state == STATE_PAM_WRONG)
                 return;
 
             if (skip_without_validation()) {
                 clear_input();
                 return;
             }
-            password[input_position] = '\0';
-            unlock_state = STATE_KEY_PRESSED;
-            redraw_screen();
             input_done();
             skip_repeated_empty_password = true;
             return;
@@ -414,12 +678,8 @@ static void handle_key_press(xcb_key_press_event_t *event) {
                 clear_input();
                 /* Hide the unlock indicator after a bit if the password buffer is
                  * empty. */
-                if (unlock_indicator) {
-                    START_TIMER(clear_indicator_timeout, 1.0, clear_indicator_cb);
-                    unlock_state = STATE_BACKSPACE_ACTIVE;
-                    redraw_screen();
-                    unlock_state = STATE_KEY_PRESSED;
-                }
+                if (unlock_indicator)
+                    batch_feedback = STATE_BACKSPACE_ACTIVE;
                 return;
             }
             break;
@@ -433,25 +693,14 @@ static void handle_key_press(xcb_key_press_event_t *event) {
             return;
 
         case XKB_KEY_BackSpace:
-            if (input_position == 0)
+            if (!input_backspace(&password))
                 return;
+            input_position = password.length;
 
-            /* decrement input_position to point to the previous glyph */
-            u8_dec(password, &input_position);
-            password[input_position] = '\0';
-
-            /* Hide the unlock indicator after a bit if the password buffer is
-         * empty. */
-            START_TIMER(clear_indicator_timeout, 1.0, clear_indicator_cb);
-            unlock_state = STATE_BACKSPACE_ACTIVE;
-            redraw_screen();
-            unlock_state = STATE_KEY_PRESSED;
+            batch_feedback = STATE_BACKSPACE_ACTIVE;
             return;
     }
 
-    if ((input_position + 8) >= sizeof(password))
-        return;
-
 #if 0
     /* FIXME: handle all of these? */
     printf("is_keypad_key = %d\n", xcb_is_keypad_key(sym));
@@ -466,22 +715,63 @@ static void handle_key_press(xcb_key_press_event_t *event) {
     if (n < 2)
         return;
 
-    /* store it in the password array as UTF-8 */
-    memcpy(password + input_position, buffer, n - 1);
-    input_position += n - 1;
-    DEBUG("current password = %.*s\n", input_position, password);
+    /* store it in the password buffer as UTF-8, unless it is full */
+    if (!input_append(&password, buffer, n - 1))
+        return;
+    input_position = password.length;
+    DEBUG("current password = %s\n", password.text);
 
-    if (unlock_indicator) {
-        unlock_state = STATE_KEY_ACTIVE;
-        redraw_screen();
-        unlock_state = STATE_KEY_PRESSED;
+    if (unlock_indicator)
+        batch_feedback = STATE_KEY_ACTIVE;
+    batch_typed = true;
+}
+
+/*
+ * Gives the visual feedback for the key presses handled since the last call,
+ * as recorded by handle_key_press(). The last key press determines what is
+ * shown, so a whole batch costs a single frame.
+ *
+ * While the monitors are blanked, the unlock indicator goes straight to the
+ * state its timers would leave it in, so that they don’t wake us up. The
+ * frame rendered when the monitors are back on shows it.
+ *
+ */
+static void finish_key_batch(void) {
+    if (monitors_blanked) {
+        switch (batch_feedback) {
+            case STATE_KEY_ACTIVE:
+                unlock_state = STATE_KEY_PRESSED;
+                break;
+            case STATE_BACKSPACE_ACTIVE:
+                clear_indicator();
+                break;
+            default:
+                break;
+        }
+        batch_feedback = STATE_STARTED;
+    }
 
-        struct ev_timer *timeout = NULL;
-        START_TIMER(timeout, TSTAMP_N_SECS(0.25), redraw_timeout);
-        STOP_TIMER(clear_indicator_timeout);
+    switch (batch_feedback) {
+        case STATE_KEY_ACTIVE:
+            highlight_indicator(STATE_KEY_ACTIVE);
+            START_TIMER(clear_highlight_timeout, TSTAMP_N_SECS(0.25), redraw_timeout);
+            STOP_TIMER(clear_indicator_timeout);
+            break;
+        case STATE_BACKSPACE_ACTIVE:
+            /* Hide the unlock indicator after a bit if the password buffer is
+             * empty. */
+            START_TIMER(clear_indicator_timeout, 1.0, clear_indicator_cb);
+            highlight_indicator(STATE_BACKSPACE_ACTIVE);
+            break;
+        default:
+            break;
     }
 
-    START_TIMER(discard_passwd_timeout, TSTAMP_N_MINS(3), discard_passwd_cb);
+    if (batch_typed)
+        START_TIMER(discard_passwd_timeout, TSTAMP_N_MINS(3), discard_passwd_cb);
+
+    batch_feedback = STATE_STARTED;
+    batch_typed = false;
 }
 
 /*
@@ -525,7 +815,7 @@ static void process_xkb_event(xcb_generic_event_t *gevent) {
 
     DEBUG("process_xkb_event for device %d\n", event->any.deviceID);
 
-    if (event->any.deviceID != xkb_x11_get_core_keyboard_device_id(conn))
+    if (event->any.deviceID != keyboard_device())
         return;
 
     /*
@@ -551,46 +841,60 @@ static void process_xkb_event(xcb_generic_event_t *gevent) {
                                   event->state_notify.baseGroup,
                                   event->state_notify.latchedGroup,
                                   event->state_notify.lockedGroup);
+            input_update_modifiers(xkb_keymap, xkb_state);
             break;
     }
 }
 
 /*
- * Called when the properties on the root window change, e.g. when the screen
- * resolution changes. If so we update the window to cover the whole screen
- * and also redraw the image, if any.
+ * Called once per batch of events after the root window was resized or the
+ * monitors were reconfigured. Resizes the window if necessary and updates the
+ * monitor table. The background is rendered again for a changed resolution,
+ * and for changed monitors if the image is placed on each of them
+ * (--image-mode). Otherwise, moved monitors only need their unlock indicators
+ * redrawn.
  *
  */
-void handle_screen_resize(void) {
-    xcb_get_geometry_cookie_t geomc;
-    xcb_get_geometry_reply_t *geom;
-    geomc = xcb_get_geometry(conn, screen->root);
-    if ((geom = xcb_get_geometry_reply(conn, geomc, 0)) == NULL)
-        return;
-
-    if (last_resolution[0] == geom->width &&
-        last_resolution[1] == geom->height) {
-        free(geom);
-        return;
+static void handle_screen_resize(void) {
+    bool resized = (last_resolution[0] != root_size[0] ||
+                    last_resolution[1] != root_size[1]);
+    if (resized) {
+        last_resolution[0] = root_size[0];
+        last_resolution[1] = root_size[1];
+
+        uint32_t mask = XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
+        xcb_configure_window(conn, win, mask, last_resolution);
+
+        /* The cached background was rendered for the old resolution (which
+         * also means the whole screen gets repainted). */
+        free_background();
     }
 
-    last_resolution[0] = geom->width;
-    last_resolution[1] = geom->height;
+    bool monitors_changed;
+    if (!randr_query_monitors(&monitors_changed)) {
+        /* Without RandR, we only learn about changes of the root window. */
+        if (!resized)
+            return;
+        xinerama_query_screens();
+        monitors_changed = true;
+    }
 
-    free(geom);
+    /* With --low-memory, img might be freed already, render_background()
+     * then loads it again. */
+    if (monitors_changed && image_mode != IMAGE_MODE_NONE &&
+        (img != NULL || decoded_path != NULL))
+        free_background();
 
-    redraw_screen();
-
-    uint32_t mask = XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
-    xcb_configure_window(conn, win, mask, last_resolution);
-    xcb_flush(conn);
+    if (monitors_changed)
+        free_unused_indicator_sprites();
 
-    xinerama_query_screens();
-    redraw_screen();
+    if (resized || monitors_changed)
+        schedule_redraw();
 }
 
 /*
  * Callback function for PAM. We only react on password request callbacks.
+ * Called from the authentication thread, so it only reads auth_password.
  *
  */
 static int conv_callback(int num_msg, const struct pam_message **msg,
@@ -611,7 +915,7 @@ static int conv_callback(int num_msg, const struct pam_message **msg,
 
         /* return code is currently not used but should be set to zero */
         resp[c]->resp_retcode = 0;
-        if ((resp[c]->resp = strdup(password)) == NULL) {
+        if ((resp[c]->resp = strdup(auth_password.text)) == NULL) {
             perror("strdup");
             return 1;
         }
@@ -620,6 +924,154 @@ static int conv_callback(int num_msg, const struct pam_message **msg,
     return 0;
 }
 
+/*
+ * Takes a screenshot of the root window for --blur. Needs to happen before our
+ * window is mapped. Returns NULL if the screen could not be captured.
+ *
+ */
+static cairo_surface_t *capture_screen(void) {
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+                                                          screen->width_in_pixels,
+                                                          screen->height_in_pixels);
+    if (cairo_surface_status(surface) == CAIRO_STATUS_SUCCESS) {
+        cairo_surface_flush(surface);
+        if (get_root_image(conn, screen, cairo_image_surface_get_data(surface),
+                           cairo_image_surface_get_stride(surface))) {
+            cairo_surface_mark_dirty(surface);
+            report_timing("screen captured");
+            return surface;
+        }
+    }
+
+    fprintf(stderr, "Could not capture the screen, not blurring\n");
+    cairo_surface_destroy(surface);
+    return NULL;
+}
+
+/*
+ * Computes the size the image needs to be decoded at. It is only scaled to the
+ * monitors with --image-mode=fill|fit|stretch, in which case it never needs to
+ * be larger than the largest monitor. Otherwise, it is painted pixel by pixel
+ * and needs to be decoded at full size.
+ *
+ */
+static void image_decode_size(int *width, int *height) {
+    *width = *height = 0;
+    if (image_mode != IMAGE_MODE_FILL &&
+        image_mode != IMAGE_MODE_FIT &&
+        image_mode != IMAGE_MODE_STRETCH)
+        return;
+
+    if (xr_screens == 0) {
+        *width = last_resolution[0];
+        *height = last_resolution[1];
+        return;
+    }
+
+    for (int i = 0; i < xr_screens; i++) {
+        if (xr_resolutions[i].width > *width)
+            *width = xr_resolutions[i].width;
+        if (xr_resolutions[i].height > *height)
+            *height = xr_resolutions[i].height;
+    }
+}
+
+/*
+ * Runs in a separate thread, so that the window can already be mapped while
+ * the image is being decoded (or blurred).
+ *
+ */
+static void *decode_image(void *arg) {
+    if (blur_sigma > 0) {
+        cairo_surface_flush(decoded_img);
+        blur_image(cairo_image_surface_get_data(decoded_img),
+                   cairo_image_surface_get_width(decoded_img),
+                   cairo_image_surface_get_height(decoded_img),
+                   cairo_image_surface_get_stride(decoded_img),
+                   blur_sigma);
+        cairo_surface_mark_dirty(decoded_img);
+    } else {
+        decoded_img = load_image(decoded_path, decoded_min_width, decoded_min_height);
+    }
+    ev_async_send(main_loop, &decode_done_watcher);
+    return NULL;
+}
+
+/*
+ * Waits for the image to be decoded and starts using it as the background.
+ * Does nothing if the image was already taken care of.
+ *
+ */
+static void finish_image_decode(void) {
+    if (!decode_pending)
+        return;
+
+    decode_pending = false;
+    if (decode_thread_started)
+        pthread_join(decode_thread, NULL);
+
+    /* In case loading failed, we just pretend no -i was specified.
+     * load_image() already printed why. */
+    if (decoded_img == NULL)
+        return;
+
+    img = decoded_img;
+    free_background();
+    schedule_redraw();
+    report_timing("image ready");
+}
+
+/* Whether the image was already requested, so that it is not decoded twice,
+ * and not retried over and over if it cannot be loaded. */
+static bool image_requested = false;
+
+/*
+ * Starts decoding the image (or blurring the screenshot) while the window is
+ * mapped with the background color, it will be drawn as soon as it is ready.
+ * Does nothing if this was already requested before.
+ *
+ */
+void request_image_decode(void) {
+    if (image_requested || (!decoded_path && !decoded_img))
+        return;
+    image_requested = true;
+
+    decode_pending = true;
+    image_decode_size(&decoded_min_width, &decoded_min_height);
+    decode_thread_started = (pthread_create(&decode_thread, NULL, decode_image, NULL) == 0);
+    if (!decode_thread_started) {
+        if (debug_mode)
+            fprintf(stderr, "Could not start image decoding thread, decoding synchronously\n");
+        decode_image(NULL);
+    }
+}
+
+/*
+ * Called once the image is uploaded into the background pixmap. With
+ * --low-memory, the client-side copy is freed right away, it is loaded again
+ * (from the background cache or the file) when the screen layout changes. The
+ * blurred screenshot cannot be taken again, so it is kept.
+ *
+ */
+void image_uploaded(void) {
+    if (!low_memory || !img || !decoded_path)
+        return;
+
+    DEBUG("freeing the client-side copy of the image\n");
+    cairo_surface_destroy(img);
+    img = NULL;
+    decoded_img = NULL;
+    image_requested = false;
+}
+
+static void decode_done_cb(EV_P_ ev_async *w, int revents) {
+    finish_image_decode();
+}
+
+static void stats_signal_cb(EV_P_ ev_signal *w, int revents) {
+    stats_dump();
+}
+
 /*
  * This callback is only a dummy, see xcb_prepare_cb and xcb_check_cb.
  * See also man libev(3): "ev_prepare" and "ev_check" - customise your event loop
@@ -630,13 +1082,45 @@ static void xcb_got_event(EV_P_ struct ev_io *w, int revents) {
 }
 
 /*
- * Flush before blocking (and waiting for new events)
+ * Render the scheduled frame (if any) and flush before blocking (and waiting
+ * for new events). This way, we render at most one frame per loop iteration, no
+ * matter how many events changed the state in the meantime.
  *
  */
 static void xcb_prepare_cb(EV_P_ ev_prepare *w, int revents) {
+    process_scheduled_redraw();
     xcb_flush(conn);
 }
 
+/*
+ * Suspends rendering while the monitors are blanked, and renders one frame
+ * when they are back on. Timers which only change what the unlock indicator
+ * shows are run right away when blanking, so that they don’t wake us up while
+ * nobody is looking. Password input (including discarding it after a while)
+ * keeps working as usual.
+ *
+ */
+static void update_power_state(void) {
+    bool blanked = power_blanked();
+    if (blanked == monitors_blanked)
+        return;
+    monitors_blanked = blanked;
+    DEBUG("monitors %s\n", (blanked ? "blanked, suspending rendering" : "back on"));
+
+    anim_suspend(blanked);
+    if (!blanked) {
+        schedule_redraw();
+        return;
+    }
+
+    if (ev_is_active(&clear_highlight_timeout))
+        ev_invoke(main_loop, &clear_highlight_timeout, EV_TIMER);
+    if (ev_is_active(&clear_indicator_timeout))
+        ev_invoke(main_loop, &clear_indicator_timeout, EV_TIMER);
+    if (ev_is_active(&clear_pam_wrong_timeout))
+        ev_invoke(main_loop, &clear_pam_wrong_timeout, EV_TIMER);
+}
+
 /*
  * Instead of polling the X connection socket we leave this to
  * xcb_poll_for_event() which knows better than we can ever know.
@@ -663,6 +1147,7 @@ static void xcb_check_cb(EV_P_ ev_check *w, int revents) {
 
         switch (type) {
             case XCB_KEY_PRESS:
+                stats_key_received();
                 handle_key_press((xcb_key_press_event_t *)event);
                 break;
 
@@ -671,30 +1156,56 @@ static void xcb_check_cb(EV_P_ ev_check *w, int revents) {
                 break;
 
             case XCB_MAP_NOTIFY:
-                if (!dont_fork) {
-                    /* After the first MapNotify, we never fork again. We don’t
-                     * expect to get another MapNotify, but better be sure… */
-                    dont_fork = true;
-
-                    /* In the parent process, we exit */
-                    if (fork() != 0)
-                        exit(0);
-
-                    ev_loop_fork(EV_DEFAULT);
+                report_timing("window mapped");
+                if (daemon_mode)
+                    stats_record_since(STAT_MAPPED, lock_start);
+                else
+                    stats_record_since_start(STAT_MAPPED);
+                if (mapped_fd != -1) {
+                    /* The parent waits for this to exit, see
+                     * fork_into_background(). We don’t expect to get another
+                     * MapNotify, but better be sure… */
+                    const char mapped = 1;
+                    if (write(mapped_fd, &mapped, 1) != 1 && debug_mode)
+                        fprintf(stderr, "Could not notify the parent process: %s\n", strerror(errno));
+                    close(mapped_fd);
+                    mapped_fd = -1;
                 }
                 break;
 
-            case XCB_CONFIGURE_NOTIFY:
-                handle_screen_resize();
+            case XCB_CONFIGURE_NOTIFY: {
+                /* Our own window is only ever resized by us. */
+                xcb_configure_notify_event_t *configure = (xcb_configure_notify_event_t *)event;
+                if (configure->window != screen->root)
+                    break;
+                root_size[0] = configure->width;
+                root_size[1] = configure->height;
+                screen_changed = true;
                 break;
+            }
 
             default:
                 if (type == xkb_base_event)
                     process_xkb_event(event);
+                else if (randr_is_event(type))
+                    screen_changed = true;
+                else if (power_handle_event(event))
+                    update_power_state();
+                else
+                    present_handle_event(event);
         }
 
         free(event);
     }
+
+    finish_key_batch();
+
+    if (screen_changed) {
+        screen_changed = false;
+        handle_screen_resize();
+        /* Turning off all outputs also blanks the screen. */
+        update_power_state();
+    }
 }
 
 /*
@@ -737,7 +1248,8 @@ static void raise_loop(xcb_window_t window) {
                 break;
             case XCB_UNMAP_NOTIFY:
                 DEBUG("UnmapNotify for 0x%08x\n", (((xcb_unmap_notify_event_t *)event)->window));
-                if (((xcb_unmap_notify_event_t *)event)->window == window)
+                /* The daemon unmaps its window after every unlock. */
+                if (((xcb_unmap_notify_event_t *)event)->window == window && !daemon_mode)
                     exit(EXIT_SUCCESS);
                 break;
             case XCB_DESTROY_NOTIFY:
@@ -753,6 +1265,98 @@ static void raise_loop(xcb_window_t window) {
     }
 }
 
+/*
+ * Forks into the background. The child goes on to lock the screen, while the
+ * parent waits until the window is mapped and then exits, so that
+ * "i3lock && suspend" suspends only once the screen is locked. If the child
+ * exits before (e.g. because it could not grab the keyboard), the parent exits
+ * with its status.
+ *
+ * This happens before the image is decoded in a thread, since only the
+ * calling thread survives fork(). The decoding still overlaps with mapping
+ * the window, all in the child.
+ *
+ */
+static void fork_into_background(void) {
+    int fds[2];
+    if (pipe(fds) != 0)
+        err(EXIT_FAILURE, "pipe");
+
+    pid_t pid = fork();
+    if (pid == -1)
+        err(EXIT_FAILURE, "fork");
+    if (pid == 0) {
+        /* Child */
+        close(fds[0]);
+        mapped_fd = fds[1];
+        ev_loop_fork(EV_DEFAULT);
+        return;
+    }
+
+    close(fds[1]);
+    char mapped;
+    ssize_t n;
+    while ((n = read(fds[0], &mapped, 1)) == -1 && errno == EINTR)
+        ;
+    if (n == 1)
+        exit(EXIT_SUCCESS);
+
+    int status;
+    if (waitpid(pid, &status, 0) == pid && WIFEXITED(status))
+        exit(WEXITSTATUS(status));
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Forks the process running raise_loop(). This happens before connecting to
+ * X11 and before any large allocation, so that the child does not hold on to
+ * copies of the image, PAM or XKB state. The window is sent to the child
+ * through the returned pipe once it is created, see start_raise_loop().
+ *
+ * Returns -1 if the child could not be started.
+ *
+ */
+static int fork_raise_loop(void) {
+    int fds[2];
+    if (pipe(fds) != 0)
+        return -1;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* Child */
+        xcb_window_t window;
+        close(fds[1]);
+        /* EOF means i3lock exited before creating the window. */
+        if (read(fds[0], &window, sizeof(window)) != sizeof(window))
+            exit(EXIT_SUCCESS);
+        close(fds[0]);
+        raise_loop(window);
+        exit(EXIT_SUCCESS);
+    }
+
+    close(fds[0]);
+    /* The pid == -1 case is intentionally ignored here:
+     * While the child process is useful for preventing other windows from
+     * popping up while i3lock blocks, it is not critical. */
+    if (pid == -1) {
+        close(fds[1]);
+        return -1;
+    }
+    return fds[1];
+}
+
+/*
+ * Tells the child forked by fork_raise_loop() which window to watch.
+ *
+ */
+static void start_raise_loop(int fd, xcb_window_t window) {
+    if (fd == -1)
+        return;
+    if (write(fd, &window, sizeof(window)) != sizeof(window) && debug_mode)
+        fprintf(stderr, "Could not start the raise process\n");
+    close(fd);
+}
+
 int main(int argc, char *argv[]) {
     struct passwd *pw;
     char *username;
@@ -770,10 +1374,19 @@ int main(int argc, char *argv[]) {
         {"color", required_argument, NULL, 'c'},
         {"pointer", required_argument, NULL, 'p'},
         {"debug", no_argument, NULL, 0},
+        {"timing", no_argument, NULL, 0},
+        {"low-memory", no_argument, NULL, 0},
+        {"core-indicator", no_argument, NULL, 0},
+        {"font", required_argument, NULL, 0},
+        {"daemon", optional_argument, NULL, 0},
+        {"stats", required_argument, NULL, 0},
+        {"blur", required_argument, NULL, 0},
+        {"anim-budget", required_argument, NULL, 0},
         {"help", no_argument, NULL, 'h'},
         {"no-unlock-indicator", no_argument, NULL, 'u'},
         {"image", required_argument, NULL, 'i'},
         {"tiling", no_argument, NULL, 't'},
+        {"image-mode", required_argument, NULL, 0},
 
         /* options for unlock indicator colors */
         // defining a lot of different chars here for the options -- TODO find a nicer way for this, maybe not offering single character options at all
@@ -797,6 +1410,10 @@ int main(int argc, char *argv[]) {
         {"show-failed-attempts", no_argument, NULL, 'f'},
         {NULL, no_argument, NULL, 0}};
 
+    stats_init();
+    clock_gettime(CLOCK_MONOTONIC, &timing_start);
+    timing_last = timing_start;
+
     if ((pw = getpwuid(getuid())) == NULL)
         err(EXIT_FAILURE, "getpwuid() failed");
     if ((username = pw->pw_name) == NULL)
@@ -874,6 +1491,41 @@ int main(int argc, char *argv[]) {
             case 0:
                 if (strcmp(longopts[optind].name, "debug") == 0)
                     debug_mode = true;
+                else if (strcmp(longopts[optind].name, "low-memory") == 0)
+                    low_memory = true;
+                else if (strcmp(longopts[optind].name, "core-indicator") == 0)
+                    core_indicator = true;
+                else if (strcmp(longopts[optind].name, "font") == 0)
+                    font_name = strdup(optarg);
+                else if (strcmp(longopts[optind].name, "daemon") == 0) {
+                    daemon_mode = true;
+                    if (optarg)
+                        daemon_socket_path = strdup(optarg);
+                }
+                else if (strcmp(longopts[optind].name, "timing") == 0)
+                    timing_mode = true;
+                else if (strcmp(longopts[optind].name, "stats") == 0)
+                    stats_enable(optarg);
+                else if (strcmp(longopts[optind].name, "image-mode") == 0) {
+                    if (strcmp(optarg, "fill") == 0)
+                        image_mode = IMAGE_MODE_FILL;
+                    else if (strcmp(optarg, "fit") == 0)
+                        image_mode = IMAGE_MODE_FIT;
+                    else if (strcmp(optarg, "center") == 0)
+                        image_mode = IMAGE_MODE_CENTER;
+                    else if (strcmp(optarg, "stretch") == 0)
+                        image_mode = IMAGE_MODE_STRETCH;
+                    else
+                        errx(EXIT_FAILURE, "i3lock-color: Invalid image mode given. Expected one of \"fill\", \"fit\", \"center\" or \"stretch\".\n");
+                }
+                else if (strcmp(longopts[optind].name, "blur") == 0) {
+                    if (sscanf(optarg, "%d", &blur_sigma) != 1 || blur_sigma < 1 || blur_sigma > 100)
+                        errx(EXIT_FAILURE, "invalid blur, it must be an integer between 1 and 100\n");
+                }
+                else if (strcmp(longopts[optind].name, "anim-budget") == 0) {
+                    if (sscanf(optarg, "%d", &anim_budget) != 1 || anim_budget < 0 || anim_budget > 100)
+                        errx(EXIT_FAILURE, "invalid animation budget, it must be an integer between 0 and 100\n");
+                }
                 else if (strcmp(longopts[optind].name, "insidevercolor") == 0) {
                     char *arg = optarg;
 
@@ -994,17 +1646,34 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if (blur_sigma > 0 && image_path)
+        errx(EXIT_FAILURE, "i3lock-color: Options blur and image conflict.");
+    if (image_mode != IMAGE_MODE_NONE && tile)
+        errx(EXIT_FAILURE, "i3lock-color: Options image-mode and tiling conflict.");
+    if (image_mode != IMAGE_MODE_NONE && blur_sigma > 0)
+        errx(EXIT_FAILURE, "i3lock-color: Options image-mode and blur conflict.");
+    /* The screenshot would need to be taken when locking, not in advance. */
+    if (daemon_mode && blur_sigma > 0)
+        errx(EXIT_FAILURE, "i3lock-color: Options daemon and blur conflict.");
+
+    if (daemon_mode) {
+        /* The daemon stays in the foreground, waiting for lock requests. */
+        dont_fork = true;
+        locked = false;
+        if (daemon_socket_path == NULL)
+            daemon_socket_path = daemon_default_socket_path();
+    }
+
+    int raise_fd = fork_raise_loop();
+
+    /* Parse the colors once, so that drawing never needs to look at the
+     * option strings. */
+    init_theme();
+
     /* We need (relatively) random numbers for highlighting a random part of
      * the unlock indicator upon keypresses. */
     srand(time(NULL));
 
-    /* Initialize PAM */
-    if ((ret = pam_start("i3lock-color", username, &conv, &pam_handle)) != PAM_SUCCESS)
-        errx(EXIT_FAILURE, "PAM: %s", pam_strerror(pam_handle, ret));
-
-    if ((ret = pam_set_item(pam_handle, PAM_TTY, getenv("DISPLAY"))) != PAM_SUCCESS)
-        errx(EXIT_FAILURE, "PAM: %s", pam_strerror(pam_handle, ret));
-
 /* Using mlock() as non-super-user seems only possible in Linux. Users of other
  * operating systems should use encrypted swap/no swap (or remove the ifdef and
  * run i3lock as super-user). */
@@ -1012,7 +1681,7 @@ int main(int argc, char *argv[]) {
     /* Lock the area where we store the password in memory, we don’t want it to
      * be swapped to disk. Since Linux 2.6.9, this does not require any
      * privileges, just enough bytes in the RLIMIT_MEMLOCK limit. */
-    if (mlock(password, sizeof(password)) != 0)
+    if (!input_lock(&password) || !input_lock(&auth_password))
         err(EXIT_FAILURE, "Could not lock page in memory, check RLIMIT_MEMLOCK");
 #endif
 
@@ -1022,16 +1691,34 @@ int main(int argc, char *argv[]) {
         xcb_connection_has_error(conn))
         errx(EXIT_FAILURE, "Could not connect to X11, maybe you need to set DISPLAY?");
 
-    if (xkb_x11_setup_xkb_extension(conn,
-                                    XKB_X11_MIN_MAJOR_XKB_VERSION,
-                                    XKB_X11_MIN_MINOR_XKB_VERSION,
-                                    0,
-                                    NULL,
-                                    NULL,
-                                    &xkb_base_event,
-                                    &xkb_base_error) != 1)
+    /* Ask for the extensions we need up front. The replies arrive while we
+     * set up XKB, so that nothing waits for them later on. */
+    xcb_prefetch_extension_data(conn, &xcb_randr_id);
+    xcb_prefetch_extension_data(conn, &xcb_xinerama_id);
+    xcb_prefetch_extension_data(conn, &xcb_shm_id);
+    xcb_prefetch_extension_data(conn, &xcb_present_id);
+    xcb_prefetch_extension_data(conn, &xcb_xfixes_id);
+    xcb_prefetch_extension_data(conn, &xcb_dpms_id);
+    report_timing("connected to X11");
+
+    stats_round_trip_start();
+    int xkb_setup = xkb_x11_setup_xkb_extension(conn,
+                                                XKB_X11_MIN_MAJOR_XKB_VERSION,
+                                                XKB_X11_MIN_MINOR_XKB_VERSION,
+                                                0,
+                                                NULL,
+                                                NULL,
+                                                &xkb_base_event,
+                                                &xkb_base_error);
+    stats_round_trip_done(ROUND_TRIP_SITE, NULL);
+    if (xkb_setup != 1)
         errx(EXIT_FAILURE, "Could not setup XKB extension.");
 
+    /* Only sends the request, the reply is collected by
+     * randr_query_monitors() once the keymap is loaded. */
+    randr_init();
+    power_init();
+
     static const xcb_xkb_map_part_t required_map_parts =
         (XCB_XKB_MAP_PART_KEY_TYPES |
          XCB_XKB_MAP_PART_KEY_SYMS |
@@ -1048,7 +1735,7 @@ int main(int argc, char *argv[]) {
 
     xcb_xkb_select_events(
         conn,
-        xkb_x11_get_core_keyboard_device_id(conn),
+        keyboard_device(),
         required_events,
         0,
         required_events,
@@ -1059,73 +1746,105 @@ int main(int argc, char *argv[]) {
     /* When we cannot initially load the keymap, we better exit */
     if (!load_keymap())
         errx(EXIT_FAILURE, "Could not load keymap");
+    report_timing("keymap loaded");
 
-    const char *locale = getenv("LC_ALL");
-    if (!locale)
-        locale = getenv("LC_CTYPE");
-    if (!locale)
-        locale = getenv("LANG");
-    if (!locale) {
-        if (debug_mode)
-            fprintf(stderr, "Can't detect your locale, fallback to C\n");
-        locale = "C";
+    screen = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
+
+    bool monitors_changed;
+    if (!randr_query_monitors(&monitors_changed)) {
+        xinerama_init();
+        xinerama_query_screens();
     }
 
-    load_compose_table(locale);
+    last_resolution[0] = root_size[0] = screen->width_in_pixels;
+    last_resolution[1] = root_size[1] = screen->height_in_pixels;
 
-    xinerama_init();
-    xinerama_query_screens();
+    xcb_change_window_attributes(conn, screen->root, XCB_CW_EVENT_MASK,
+                                 (uint32_t[]){XCB_EVENT_MASK_STRUCTURE_NOTIFY});
 
-    screen = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
+    /* Initialize the libev event loop. */
+    main_loop = EV_DEFAULT;
+    if (main_loop == NULL)
+        errx(EXIT_FAILURE, "Could not initialize libev. Bad LIBEV_FLAGS?\n");
+    anim_init(anim_budget);
 
-    last_resolution[0] = screen->width_in_pixels;
-    last_resolution[1] = screen->height_in_pixels;
+    if (!dont_fork)
+        fork_into_background();
 
-    xcb_change_window_attributes(conn, screen->root, XCB_CW_EVENT_MASK,
-                                 (uint32_t[]){XCB_EVENT_MASK_STRUCTURE_NOTIFY});
+    if (blur_sigma > 0)
+        decoded_img = capture_screen();
 
-    if (image_path) {
-        /* Create a pixmap to render on, fill it with the background color */
-        img = cairo_image_surface_create_from_png(image_path);
-        /* In case loading failed, we just pretend no -i was specified. */
-        if (cairo_surface_status(img) != CAIRO_STATUS_SUCCESS) {
-            fprintf(stderr, "Could not load image \"%s\": %s\n",
-                    image_path, cairo_status_to_string(cairo_surface_status(img)));
-            img = NULL;
-        }
+    if (image_path || decoded_img) {
+        ev_async_init(&decode_done_watcher, decode_done_cb);
+        ev_async_start(main_loop, &decode_done_watcher);
+        decoded_path = image_path;
+
+        /* When the background for this image and layout is cached, the image
+         * is only decoded if the layout changes later on. */
+        if (image_path)
+            bgcache_init(image_path);
+        if (decoded_img || !bgcache_contains(last_resolution))
+            request_image_decode();
     }
 
     /* Pixmap on which the image is rendered to (if any) */
     xcb_pixmap_t bg_pixmap = draw_image(last_resolution);
 
     /* open the fullscreen window, already with the correct pixmap in place */
-    win = open_fullscreen_window(conn, screen, color, bg_pixmap);
-    xcb_free_pixmap(conn, bg_pixmap);
+    win = open_fullscreen_window(conn, screen, theme.background_pixel, bg_pixmap);
+    /* Later frames are presented in sync with the vertical blank. */
+    present_init(win);
+    /* The daemon only maps the window when locking. */
+    if (!daemon_mode)
+        map_fullscreen_window(conn, win);
+    xcb_flush(conn);
+    report_timing("window created");
+    /* Only once the window is mapped, since this waits for the Present
+     * version. */
+    init_window_background();
 
-    pid_t pid = fork();
-    /* The pid == -1 case is intentionally ignored here:
-     * While the child process is useful for preventing other windows from
-     * popping up while i3lock blocks, it is not critical. */
-    if (pid == 0) {
-        /* Child */
-        close(xcb_get_file_descriptor(conn));
-        raise_loop(win);
-        exit(EXIT_SUCCESS);
-    }
+    start_raise_loop(raise_fd, win);
 
     cursor = create_cursor(conn, screen, win, curs_choice);
 
-    grab_pointer_and_keyboard(conn, screen, cursor);
-    /* Load the keymap again to sync the current modifier state. Since we first
-     * loaded the keymap, there might have been changes, but starting from now,
-     * we should get all key presses/releases due to having grabbed the
-     * keyboard. */
-    (void)load_keymap();
+    if (!daemon_mode) {
+        double grab_start = stats_now();
+        if (!grab_pointer_and_keyboard(conn, screen, cursor))
+            exit(EXIT_FAILURE);
+        stats_record_since(STAT_GRAB, grab_start);
+        report_timing("pointer and keyboard grabbed");
+        /* The modifier state does not need to be fetched again: every change
+         * since load_keymap() arrives as an XKB state notify event, see
+         * process_xkb_event(). */
+    }
 
-    /* Initialize the libev event loop. */
-    main_loop = EV_DEFAULT;
-    if (main_loop == NULL)
-        errx(EXIT_FAILURE, "Could not initialize libev. Bad LIBEV_FLAGS?\n");
+    /* PAM is not needed before the first key press, so it is set up only
+     * once the screen is covered. */
+    if ((ret = pam_start("i3lock-color", username, &conv, &pam_handle)) != PAM_SUCCESS)
+        errx(EXIT_FAILURE, "PAM: %s", pam_strerror(pam_handle, ret));
+
+    if ((ret = pam_set_item(pam_handle, PAM_TTY, getenv("DISPLAY"))) != PAM_SUCCESS)
+        errx(EXIT_FAILURE, "PAM: %s", pam_strerror(pam_handle, ret));
+    report_timing("PAM initialized");
+
+    const char *locale = getenv("LC_ALL");
+    if (!locale)
+        locale = getenv("LC_CTYPE");
+    if (!locale)
+        locale = getenv("LANG");
+    if (!locale) {
+        if (debug_mode)
+            fprintf(stderr, "Can't detect your locale, fallback to C\n");
+        locale = "C";
+    }
+
+    /* The daemon has time to spare, everyone else loads the compose table
+     * only when it is needed. */
+    compose_locale = locale;
+    if (daemon_mode) {
+        load_compose_table(locale);
+        report_timing("compose table loaded");
+    }
 
     struct ev_io *xcb_watcher = calloc(sizeof(struct ev_io), 1);
     struct ev_check *xcb_check = calloc(sizeof(struct ev_check), 1);
@@ -1140,6 +1859,28 @@ int main(int argc, char *argv[]) {
     ev_prepare_init(xcb_prepare, xcb_prepare_cb);
     ev_prepare_start(main_loop, xcb_prepare);
 
+    ev_async_init(&auth_done_watcher, auth_done_cb);
+    ev_async_start(main_loop, &auth_done_watcher);
+
+    if (stats_enabled()) {
+        ev_signal_init(&stats_signal_watcher, stats_signal_cb, SIGUSR1);
+        ev_signal_start(main_loop, &stats_signal_watcher);
+    }
+
+    if (daemon_mode) {
+        /* The image needs to be ready before the first lock. */
+        finish_image_decode();
+
+        daemon_listen(daemon_socket_path, lock_screen, is_locked);
+        ev_signal_init(&lock_signal_watcher, lock_signal_cb, SIGUSR2);
+        ev_signal_start(main_loop, &lock_signal_watcher);
+        ev_signal_init(&term_signal_watcher, exit_signal_cb, SIGTERM);
+        ev_signal_start(main_loop, &term_signal_watcher);
+        ev_signal_init(&int_signal_watcher, exit_signal_cb, SIGINT);
+        ev_signal_start(main_loop, &int_signal_watcher);
+        report_timing("daemon ready");
+    }
+
     /* Invoke the event callback once to catch all the events which were
      * received up until now. ev will only pick up new events (when the X11
      * file descriptor becomes readable). */
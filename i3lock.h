@@ -11,4 +11,8 @@
             printf("[i3lock-debug] " fmt, ##__VA_ARGS__); \
     } while (0)
 
+void report_timing(const char *phase);
+void request_image_decode(void);
+void image_uploaded(void);
+
 #endif
@@ -0,0 +1,170 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * image.c: loads the image (-i) into a cairo image surface. PNG images are
+ *          decoded by cairo, JPEG images by libjpeg (if available), which can
+ *          decode them at a fraction of their size right away.
+ *
+ * See LICENSE for licensing information
+ *
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <cairo.h>
+
+#ifdef HAVE_LIBJPEG
+#include <setjmp.h>
+#include <jpeglib.h>
+#endif
+
+#include "i3lock.h"
+#include "image.h"
+
+extern bool debug_mode;
+
+#ifdef HAVE_LIBJPEG
+struct jpeg_error_handler {
+    struct jpeg_error_mgr mgr;
+    jmp_buf env;
+};
+
+/*
+ * Called by libjpeg for fatal errors. Instead of calling exit() like the
+ * default handler, jumps back into load_jpeg().
+ *
+ */
+static void jpeg_error_exit(j_common_ptr cinfo) {
+    struct jpeg_error_handler *handler = (struct jpeg_error_handler *)cinfo->err;
+    longjmp(handler->env, 1);
+}
+
+/*
+ * Decodes the given JPEG file with the largest DCT scaling (1/2, 1/4 or 1/8)
+ * which still yields an image of at least min_width × min_height pixels.
+ * Scaling in the DCT domain skips most of the work, so this is a lot faster
+ * than decoding at full size and scaling afterwards.
+ *
+ * Returns NULL if the file could not be decoded.
+ *
+ */
+static cairo_surface_t *load_jpeg(FILE *file, const char *path, int min_width, int min_height) {
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_handler handler;
+    /* volatile, since it is modified between setjmp() and longjmp(). */
+    cairo_surface_t *volatile surface = NULL;
+
+    cinfo.err = jpeg_std_error(&handler.mgr);
+    handler.mgr.error_exit = jpeg_error_exit;
+    if (setjmp(handler.env)) {
+        char message[JMSG_LENGTH_MAX];
+        handler.mgr.format_message((j_common_ptr)&cinfo, message);
+        fprintf(stderr, "Could not load image \"%s\": %s\n", path, message);
+        jpeg_destroy_decompress(&cinfo);
+        if (surface != NULL)
+            cairo_surface_destroy(surface);
+        return NULL;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, file);
+    jpeg_read_header(&cinfo, TRUE);
+
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = 1;
+    while (min_width > 0 && min_height > 0 && cinfo.scale_denom < 8 &&
+           cinfo.image_width / (cinfo.scale_denom * 2) >= (unsigned int)min_width &&
+           cinfo.image_height / (cinfo.scale_denom * 2) >= (unsigned int)min_height)
+        cinfo.scale_denom *= 2;
+
+#ifdef JCS_EXTENSIONS
+    /* libjpeg-turbo can write the pixels in cairo’s format directly. */
+    cinfo.out_color_space = (__BYTE_ORDER == __LITTLE_ENDIAN ? JCS_EXT_BGRX : JCS_EXT_XRGB);
+#else
+    cinfo.out_color_space = JCS_RGB;
+#endif
+    jpeg_start_decompress(&cinfo);
+
+    DEBUG("decoding %d x %d JPEG at 1/%d scale: %d x %d\n",
+          cinfo.image_width, cinfo.image_height, cinfo.scale_denom,
+          cinfo.output_width, cinfo.output_height);
+
+    surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, cinfo.output_width, cinfo.output_height);
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+        fprintf(stderr, "Could not load image \"%s\": %s\n",
+                path, cairo_status_to_string(cairo_surface_status(surface)));
+        jpeg_destroy_decompress(&cinfo);
+        cairo_surface_destroy(surface);
+        return NULL;
+    }
+
+    unsigned char *data = cairo_image_surface_get_data(surface);
+    const int stride = cairo_image_surface_get_stride(surface);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = data + cinfo.output_scanline * stride;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+#ifndef JCS_EXTENSIONS
+        /* Expand RGB to cairo’s native-endian XRGB in place, from the end of
+         * the row so that no pixel is overwritten before it was read. */
+        uint32_t *pixels = (uint32_t *)row;
+        for (int x = cinfo.output_width - 1; x >= 0; x--)
+            pixels[x] = (row[3 * x] << 16) | (row[3 * x + 1] << 8) | row[3 * x + 2];
+#endif
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    cairo_surface_mark_dirty(surface);
+
+    return surface;
+}
+#endif
+
+/*
+ * Loads the image at the given path. Formats which support decoding at a
+ * reduced size are decoded at the smallest size which still is at least
+ * min_width × min_height pixels, 0 means full size. The image might still be
+ * larger than necessary, the caller needs to scale it either way.
+ *
+ * Returns NULL (after printing an error) if the image could not be loaded.
+ *
+ */
+cairo_surface_t *load_image(const char *path, int min_width, int min_height) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not load image \"%s\": %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    unsigned char magic[3] = {0};
+    size_t length = fread(magic, 1, sizeof(magic), file);
+    rewind(file);
+
+    if (length == sizeof(magic) && magic[0] == 0xFF && magic[1] == 0xD8 && magic[2] == 0xFF) {
+#ifdef HAVE_LIBJPEG
+        cairo_surface_t *surface = load_jpeg(file, path, min_width, min_height);
+        fclose(file);
+        return surface;
+#else
+        fprintf(stderr, "Could not load image \"%s\": i3lock was built without JPEG support\n", path);
+        fclose(file);
+        return NULL;
+#endif
+    }
+    fclose(file);
+
+    cairo_surface_t *surface = cairo_image_surface_create_from_png(path);
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+        fprintf(stderr, "Could not load image \"%s\": %s\n",
+                path, cairo_status_to_string(cairo_surface_status(surface)));
+        cairo_surface_destroy(surface);
+        return NULL;
+    }
+
+    return surface;
+}
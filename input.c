@@ -0,0 +1,183 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * input.c: the buffer which holds the password while it is being typed, and
+ *          the label of the active modifiers shown after a wrong password.
+ *          Nothing here allocates memory, so that a key press takes the same
+ *          (short) time no matter how long the password already is.
+ *
+ * See LICENSE for licensing information
+ *
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "input.h"
+
+/* isutf © 2005 Jeff Bezanson, public domain */
+#define isutf(c) (((c)&0xC0) != 0x80)
+
+/* The label of the modifiers in label_mask, see input_update_modifiers(). */
+static char modifier_label[MODIFIER_LABEL_SIZE];
+static xkb_mod_mask_t label_mask;
+/* Set when the keymap changed, since the same mask might then stand for
+ * different modifiers. */
+static bool label_stale = true;
+
+/*
+ * Overwrites the given number of bytes, to be a bit safer against cold-boot
+ * attacks. Writing through a volatile pointer prevents the compiler from
+ * optimizing this out.
+ *
+ */
+static void wipe(void *buffer, size_t size) {
+    volatile unsigned char *vbuffer = buffer;
+    for (size_t c = 0; c < size; c++)
+        vbuffer[c] = 0;
+}
+
+/*
+ * Locks the buffer in memory, so that the password is never swapped to disk.
+ * Returns false (with errno set) if RLIMIT_MEMLOCK does not allow it.
+ *
+ */
+bool input_lock(input_buffer_t *input) {
+    return (mlock(input, sizeof(*input)) == 0);
+}
+
+/*
+ * Appends the given UTF-8 text (usually a single character) to the buffer.
+ * Returns false if it does not fit, in which case the buffer is unchanged.
+ *
+ */
+bool input_append(input_buffer_t *input, const char *utf8, int length) {
+    if (length <= 0 || input->length + length >= INPUT_CAPACITY)
+        return false;
+
+    for (int i = 0; i < length; i++) {
+        /* A stray continuation byte at the start still begins a new code
+         * point, so that backspace never removes more than was appended. */
+        if (i == 0 || isutf(utf8[i]))
+            input->starts[input->code_points++] = input->length + i;
+        input->text[input->length + i] = utf8[i];
+    }
+    input->length += length;
+    input->text[input->length] = '\0';
+    return true;
+}
+
+/*
+ * Removes the last code point from the buffer. Returns false if the buffer
+ * was already empty.
+ *
+ */
+bool input_backspace(input_buffer_t *input) {
+    if (input->code_points == 0)
+        return false;
+
+    int start = input->starts[--input->code_points];
+    wipe(input->text + start, input->length - start);
+    /* The offsets tell the length of every character. */
+    wipe(&input->starts[input->code_points], sizeof(input->starts[0]));
+    input->length = start;
+    return true;
+}
+
+/*
+ * Empties the buffer. Removed bytes and offsets are always overwritten, so
+ * only the used part needs to be.
+ *
+ */
+void input_clear(input_buffer_t *input) {
+    wipe(input->text, input->length);
+    wipe(input->starts, input->code_points * sizeof(input->starts[0]));
+    input->length = 0;
+    input->code_points = 0;
+}
+
+/*
+ * Moves the contents of from to to, e.g. to hand the password over for
+ * authentication, and empties from.
+ *
+ */
+void input_move(input_buffer_t *to, input_buffer_t *from) {
+    input_clear(to);
+    memcpy(to->text, from->text, from->length + 1);
+    memcpy(to->starts, from->starts, from->code_points * sizeof(from->starts[0]));
+    to->length = from->length;
+    to->code_points = from->code_points;
+    input_clear(from);
+}
+
+/*
+ * Called when a new keymap was loaded, so that the next
+ * input_update_modifiers() builds the label again.
+ *
+ */
+void input_keymap_changed(void) {
+    label_stale = true;
+}
+
+/*
+ * Builds the label of the active modifiers, replacing certain xkb names with
+ * nicer, human-readable ones. Called for every XKB state change, so the label
+ * is ready when a password turns out to be wrong. It is only built again when
+ * the set of active modifiers changed.
+ *
+ */
+void input_update_modifiers(struct xkb_keymap *keymap, struct xkb_state *state) {
+    xkb_mod_mask_t mask = xkb_state_serialize_mods(state, XKB_STATE_MODS_EFFECTIVE);
+    if (!label_stale && mask == label_mask)
+        return;
+    label_stale = false;
+    label_mask = mask;
+
+    size_t used = 0;
+    modifier_label[0] = '\0';
+
+    xkb_mod_index_t num_mods = xkb_keymap_num_mods(keymap);
+    /* The mask has one bit per modifier, xkb supports no more than that. */
+    if (num_mods > 32)
+        num_mods = 32;
+
+    for (xkb_mod_index_t idx = 0; idx < num_mods; idx++) {
+        if (!(mask & (UINT32_C(1) << idx)))
+            continue;
+
+        const char *mod_name = xkb_keymap_mod_get_name(keymap, idx);
+        if (mod_name == NULL)
+            continue;
+
+        if (strcmp(mod_name, XKB_MOD_NAME_CAPS) == 0)
+            mod_name = "Caps Lock";
+        else if (strcmp(mod_name, XKB_MOD_NAME_ALT) == 0)
+            mod_name = "Alt";
+        else if (strcmp(mod_name, XKB_MOD_NAME_NUM) == 0)
+            mod_name = "Num Lock";
+        else if (strcmp(mod_name, XKB_MOD_NAME_LOGO) == 0)
+            mod_name = "Win";
+
+        int n = snprintf(modifier_label + used, sizeof(modifier_label) - used,
+                         "%s%s", (used > 0 ? ", " : ""), mod_name);
+        if (n < 0 || (size_t)n >= sizeof(modifier_label) - used) {
+            /* Leave out the names which do not fit completely. */
+            modifier_label[used] = '\0';
+            break;
+        }
+        used += n;
+    }
+}
+
+/*
+ * Returns the label of the active modifiers, or NULL if none is active.
+ *
+ */
+const char *input_modifier_label(void) {
+    return (modifier_label[0] != '\0' ? modifier_label : NULL);
+}
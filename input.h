@@ -0,0 +1,36 @@
+#ifndef _INPUT_H
+#define _INPUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <xkbcommon/xkbcommon.h>
+
+/* The number of bytes a password can have, including the terminating NUL. */
+#define INPUT_CAPACITY 512
+
+/* The label of the active modifiers, e.g. "Caps Lock, Num Lock", is cut off
+ * after this many bytes. */
+#define MODIFIER_LABEL_SIZE 128
+
+typedef struct input_buffer {
+    /* The password in UTF-8, always NUL-terminated. */
+    char text[INPUT_CAPACITY];
+    /* The offset of every code point in text, so that backspace does not need
+     * to scan for the previous one. */
+    uint16_t starts[INPUT_CAPACITY];
+    /* The number of bytes (without the NUL) and code points in text. */
+    int length;
+    int code_points;
+} input_buffer_t;
+
+bool input_lock(input_buffer_t *input);
+bool input_append(input_buffer_t *input, const char *utf8, int length);
+bool input_backspace(input_buffer_t *input);
+void input_clear(input_buffer_t *input);
+void input_move(input_buffer_t *to, input_buffer_t *from);
+
+void input_keymap_changed(void);
+void input_update_modifiers(struct xkb_keymap *keymap, struct xkb_state *state);
+const char *input_modifier_label(void);
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * power.c: tracks whether the monitors are blanked, so that nothing is
+ *          rendered while nobody can see it. The DPMS power level is followed
+ *          via the InfoNotify events of DPMS ≥ 1.2, and RandR tells us when
+ *          all outputs are off.
+ *
+ * See LICENSE for licensing information
+ *
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <xcb/xcb.h>
+#include <xcb/dpms.h>
+
+#include "i3lock.h"
+#include "xcb.h"
+#include "randr.h"
+#include "power.h"
+#include "stats.h"
+
+extern bool debug_mode;
+
+/* Whether DPMS turned the monitors off (standby, suspend or off). */
+static bool dpms_off;
+
+/* The InfoNotify events are only known to xcb-proto ≥ 1.15. With older
+ * headers, the power level is not followed at all, see check_dpms(). */
+#ifdef XCB_DPMS_INFO_NOTIFY
+
+/* Whether the DPMS power level is followed, see check_dpms(). Without
+ * InfoNotify events, we would not notice the monitors coming back on, so the
+ * power level is not even looked at. */
+static bool dpms_active;
+/* The major opcode of the DPMS extension, to recognize its events. */
+static uint8_t dpms_opcode;
+
+/* The requests sent by power_init(). */
+static bool requests_pending;
+static xcb_dpms_get_version_cookie_t version_cookie;
+static xcb_dpms_info_cookie_t info_cookie;
+
+/*
+ * Sends the requests for the DPMS version and power level without waiting for
+ * their replies. They are collected by the first power_blanked().
+ *
+ */
+void power_init(void) {
+    const xcb_query_extension_reply_t *extension = xcb_get_extension_data(conn, &xcb_dpms_id);
+    if (!extension || !extension->present) {
+        DEBUG("DPMS extension not found, rendering even while the monitors are off.\n");
+        return;
+    }
+
+    dpms_opcode = extension->major_opcode;
+    version_cookie = xcb_dpms_get_version(conn, XCB_DPMS_MAJOR_VERSION, XCB_DPMS_MINOR_VERSION);
+    info_cookie = xcb_dpms_info(conn);
+    requests_pending = true;
+}
+
+/*
+ * Collects the replies to the requests of power_init(). If DPMS sends events
+ * when the power level changes (≥ 1.2), subscribes to them.
+ *
+ */
+static void check_dpms(void) {
+    requests_pending = false;
+
+    xcb_dpms_get_version_reply_t *version = ROUND_TRIP(xcb_dpms_get_version_reply(conn, version_cookie, NULL));
+    /* Sent together with GetVersion, so it arrived with the same round trip. */
+    xcb_dpms_info_reply_t *info = xcb_dpms_info_reply(conn, info_cookie, NULL);
+    dpms_active = (version && info &&
+                   (version->server_major_version > 1 ||
+                    (version->server_major_version == 1 && version->server_minor_version >= 2)));
+    if (dpms_active) {
+        xcb_dpms_select_input(conn, XCB_DPMS_EVENT_MASK_INFO_NOTIFY);
+        dpms_off = (info->state && info->power_level != XCB_DPMS_DPMS_MODE_ON);
+    } else if (version) {
+        DEBUG("DPMS %d.%d has no events, rendering even while the monitors are off.\n",
+              version->server_major_version, version->server_minor_version);
+    }
+    free(version);
+    free(info);
+}
+
+/*
+ * Handles the given event if it is a DPMS event. Returns false for all other
+ * events.
+ *
+ */
+bool power_handle_event(xcb_generic_event_t *event) {
+    if (!dpms_active || (event->response_type & 0x7F) != XCB_GE_GENERIC)
+        return false;
+
+    xcb_ge_generic_event_t *generic = (xcb_ge_generic_event_t *)event;
+    if (generic->extension != dpms_opcode || generic->event_type != XCB_DPMS_INFO_NOTIFY)
+        return false;
+
+    xcb_dpms_info_notify_event_t *notify = (xcb_dpms_info_notify_event_t *)event;
+    dpms_off = (notify->state && notify->power_level != XCB_DPMS_DPMS_MODE_ON);
+    DEBUG("DPMS power level %d, monitors %s\n", notify->power_level, (dpms_off ? "off" : "on"));
+    return true;
+}
+
+#else
+
+void power_init(void) {
+    DEBUG("Built without DPMS events, rendering even while the monitors are off.\n");
+}
+
+bool power_handle_event(xcb_generic_event_t *event) {
+    return false;
+}
+
+#endif
+
+/*
+ * Returns whether all monitors are blanked: turned off by DPMS, or no RandR
+ * output is active anymore (e.g. the lid of a laptop without external monitors
+ * was closed), see randr_monitors_off().
+ *
+ */
+bool power_blanked(void) {
+#ifdef XCB_DPMS_INFO_NOTIFY
+    if (requests_pending)
+        check_dpms();
+#endif
+    return (dpms_off || randr_monitors_off());
+}
@@ -0,0 +1,11 @@
+#ifndef _POWER_H
+#define _POWER_H
+
+#include <stdbool.h>
+#include <xcb/xcb.h>
+
+void power_init(void);
+bool power_blanked(void);
+bool power_handle_event(xcb_generic_event_t *event);
+
+#endif
@@ -0,0 +1,215 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * present.c: shows frames with the Present extension, so that the X server
+ *            updates the window in sync with the vertical blank (or flips to
+ *            the pixmap) instead of copying it while it is being scanned out.
+ *
+ * See LICENSE for licensing information
+ *
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <xcb/xcb.h>
+#include <xcb/xfixes.h>
+#include <xcb/present.h>
+#include <ev.h>
+
+#include "i3lock.h"
+#include "xcb.h"
+#include "present.h"
+#include "stats.h"
+
+extern bool debug_mode;
+extern struct ev_loop *main_loop;
+
+/* If the X server does not confirm a frame within this time (e.g. because the
+ * monitors are off and it only ticks once per second), the next one is
+ * presented anyway. */
+#define PRESENT_TIMEOUT 0.25
+
+/* The pixmaps which the X server may still read from, see
+ * present_pixmap_idle(). Two back buffers are presented alternately, so there
+ * are never more than two of them. */
+#define MAX_BUSY_PIXMAPS 2
+
+/* Whether Present and XFixes turned out to be usable, see present_active(). */
+static bool present_enabled;
+/* The major opcode of the Present extension, to recognize its events. */
+static uint8_t present_opcode;
+
+/* The requests sent by present_init(). */
+static bool version_pending;
+static xcb_present_query_version_cookie_t present_version_cookie;
+static xcb_xfixes_query_version_cookie_t xfixes_version_cookie;
+
+static xcb_window_t present_window;
+static xcb_present_event_t event_id;
+/* The region which tells the X server which parts of a frame changed. It is
+ * created once and set again for every frame. */
+static xcb_xfixes_region_t update_region;
+
+/* The serial of the last presented frame and whether it is still waiting for
+ * its CompleteNotify. */
+static uint32_t serial;
+static bool frame_pending;
+static ev_timer timeout_watcher;
+
+static xcb_pixmap_t busy_pixmaps[MAX_BUSY_PIXMAPS];
+
+/*
+ * Sends the version requests (XFixes needs it before its regions can be used)
+ * and subscribes to the events of the window, without waiting for any reply.
+ * The replies are collected by the first present_active().
+ *
+ */
+void present_init(xcb_window_t window) {
+    const xcb_query_extension_reply_t *present = xcb_get_extension_data(conn, &xcb_present_id);
+    const xcb_query_extension_reply_t *xfixes = xcb_get_extension_data(conn, &xcb_xfixes_id);
+    if (!present || !present->present || !xfixes || !xfixes->present) {
+        DEBUG("Present or XFixes extension not found, copying frames instead.\n");
+        return;
+    }
+
+    present_opcode = present->major_opcode;
+    present_window = window;
+    present_version_cookie = xcb_present_query_version(conn, XCB_PRESENT_MAJOR_VERSION, XCB_PRESENT_MINOR_VERSION);
+    xfixes_version_cookie = xcb_xfixes_query_version(conn, XCB_XFIXES_MAJOR_VERSION, XCB_XFIXES_MINOR_VERSION);
+
+    event_id = xcb_generate_id(conn);
+    xcb_present_select_input(conn, event_id, window,
+                             XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY |
+                                 XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY);
+    version_pending = true;
+}
+
+/*
+ * Called when the X server did not confirm the last frame in time.
+ *
+ */
+static void present_timeout_cb(EV_P_ ev_timer *w, int revents) {
+    DEBUG("Frame %u was not completed in time\n", serial);
+    frame_pending = false;
+    for (int i = 0; i < MAX_BUSY_PIXMAPS; i++)
+        busy_pixmaps[i] = XCB_NONE;
+}
+
+/*
+ * Returns whether frames are shown with the Present extension. Regions need
+ * XFixes ≥ 2.0.
+ *
+ */
+bool present_active(void) {
+    if (!version_pending)
+        return present_enabled;
+    version_pending = false;
+
+    xcb_present_query_version_reply_t *present = ROUND_TRIP(xcb_present_query_version_reply(conn, present_version_cookie, NULL));
+    /* Sent together with the Present version, so it arrived with the same
+     * round trip. */
+    xcb_xfixes_query_version_reply_t *xfixes = xcb_xfixes_query_version_reply(conn, xfixes_version_cookie, NULL);
+    present_enabled = (present && xfixes && xfixes->major_version >= 2);
+    if (present_enabled) {
+        update_region = xcb_generate_id(conn);
+        xcb_xfixes_create_region(conn, update_region, 0, NULL);
+        ev_timer_init(&timeout_watcher, present_timeout_cb, PRESENT_TIMEOUT, 0.);
+    } else {
+        DEBUG("XFixes is too old for Present, copying frames instead.\n");
+    }
+    free(present);
+    free(xfixes);
+    return present_enabled;
+}
+
+/*
+ * Returns whether the last frame is not shown yet. A new frame is only
+ * rendered after that, so that there is at most one per vertical blank.
+ *
+ */
+bool present_busy(void) {
+    return frame_pending;
+}
+
+/*
+ * Returns whether the X server is done with the given pixmap (which it might
+ * still scan out after flipping to it), so that it can be drawn into.
+ *
+ */
+bool present_pixmap_idle(xcb_pixmap_t pixmap) {
+    for (int i = 0; i < MAX_BUSY_PIXMAPS; i++)
+        if (busy_pixmaps[i] == pixmap)
+            return false;
+    return true;
+}
+
+/*
+ * Stops waiting for the given pixmap to become idle, since it is about to be
+ * freed.
+ *
+ */
+void present_forget_pixmap(xcb_pixmap_t pixmap) {
+    for (int i = 0; i < MAX_BUSY_PIXMAPS; i++)
+        if (busy_pixmaps[i] == pixmap)
+            busy_pixmaps[i] = XCB_NONE;
+}
+
+/*
+ * Shows the given pixmap in the window at the next vertical blank. Only the
+ * given areas are updated, or all of the window if count is 0.
+ *
+ */
+void present_frame(xcb_pixmap_t pixmap, const xcb_rectangle_t *rects, int count) {
+    xcb_xfixes_region_t update = XCB_NONE;
+    if (count > 0) {
+        xcb_xfixes_set_region(conn, update_region, count, rects);
+        update = update_region;
+    }
+
+    xcb_present_pixmap(conn, present_window, pixmap, ++serial,
+                       XCB_NONE, update, 0, 0,
+                       XCB_NONE, XCB_NONE, XCB_NONE,
+                       XCB_PRESENT_OPTION_NONE, 0, 0, 0, 0, NULL);
+
+    for (int i = 0; i < MAX_BUSY_PIXMAPS; i++) {
+        if (busy_pixmaps[i] == XCB_NONE) {
+            busy_pixmaps[i] = pixmap;
+            break;
+        }
+    }
+    frame_pending = true;
+    ev_timer_stop(main_loop, &timeout_watcher);
+    ev_timer_start(main_loop, &timeout_watcher);
+}
+
+/*
+ * Handles the given event if it is a Present event. Returns false for all
+ * other events.
+ *
+ */
+bool present_handle_event(xcb_generic_event_t *event) {
+    if (!present_enabled || (event->response_type & 0x7F) != XCB_GE_GENERIC)
+        return false;
+
+    xcb_ge_generic_event_t *generic = (xcb_ge_generic_event_t *)event;
+    if (generic->extension != present_opcode)
+        return false;
+
+    switch (generic->event_type) {
+        case XCB_PRESENT_COMPLETE_NOTIFY: {
+            xcb_present_complete_notify_event_t *complete = (xcb_present_complete_notify_event_t *)event;
+            if (complete->kind == XCB_PRESENT_COMPLETE_KIND_PIXMAP && complete->serial == serial) {
+                frame_pending = false;
+                ev_timer_stop(main_loop, &timeout_watcher);
+            }
+            break;
+        }
+
+        case XCB_PRESENT_IDLE_NOTIFY:
+            present_forget_pixmap(((xcb_present_idle_notify_event_t *)event)->pixmap);
+            break;
+    }
+    return true;
+}
@@ -0,0 +1,16 @@
+#ifndef _PRESENT_H
+#define _PRESENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <xcb/xcb.h>
+
+void present_init(xcb_window_t window);
+bool present_active(void);
+bool present_busy(void);
+bool present_pixmap_idle(xcb_pixmap_t pixmap);
+void present_forget_pixmap(xcb_pixmap_t pixmap);
+void present_frame(xcb_pixmap_t pixmap, const xcb_rectangle_t *rects, int count);
+bool present_handle_event(xcb_generic_event_t *event);
+
+#endif
@@ -0,0 +1,187 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * randr.c: tracks the monitors via RandR ≥ 1.5. Xinerama is used as a
+ *          fallback when it is not available.
+ *
+ * See LICENSE for licensing information
+ *
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <xcb/xcb.h>
+#include <xcb/randr.h>
+
+#include "i3lock.h"
+#include "xcb.h"
+#include "xinerama.h"
+#include "randr.h"
+#include "stats.h"
+
+extern bool debug_mode;
+
+/* Whether RandR ≥ 1.5 turned out to be usable, see randr_query_monitors(). */
+static bool randr_active;
+/* The event base of the RandR extension, to recognize its events. */
+static uint8_t randr_base_event;
+
+/* The QueryVersion request sent by randr_init(). */
+static bool version_pending;
+static xcb_randr_query_version_cookie_t version_cookie;
+
+/* Number of entries xr_resolutions has room for. It is only reallocated when
+ * monitors are added, so that frequent changes don’t churn memory. */
+static int xr_capacity;
+
+/* Whether RandR reported an active monitor before, see randr_monitors_off(). */
+static bool monitors_seen;
+
+/*
+ * Sends the QueryVersion request, without waiting for its reply, so that other
+ * requests can be sent in the meantime.
+ *
+ */
+void randr_init(void) {
+    const xcb_query_extension_reply_t *extension = xcb_get_extension_data(conn, &xcb_randr_id);
+    if (!extension || !extension->present) {
+        DEBUG("RandR extension not found, using Xinerama.\n");
+        return;
+    }
+
+    randr_base_event = extension->first_event;
+    version_cookie = xcb_randr_query_version(conn, 1, 5);
+    version_pending = true;
+}
+
+/*
+ * Collects the reply to QueryVersion. If RandR is recent enough to know about
+ * monitors, subscribes to the events which signal that they changed.
+ *
+ */
+static void check_version(void) {
+    version_pending = false;
+
+    xcb_randr_query_version_reply_t *version = ROUND_TRIP(xcb_randr_query_version_reply(conn, version_cookie, NULL));
+    if (!version)
+        return;
+
+    randr_active = (version->major_version > 1 ||
+                    (version->major_version == 1 && version->minor_version >= 5));
+    if (randr_active) {
+        xcb_randr_select_input(conn, screen->root,
+                               XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE |
+                                   XCB_RANDR_NOTIFY_MASK_CRTC_CHANGE |
+                                   XCB_RANDR_NOTIFY_MASK_OUTPUT_CHANGE);
+    } else {
+        DEBUG("RandR %d.%d does not support monitors, using Xinerama.\n",
+              version->major_version, version->minor_version);
+    }
+    free(version);
+}
+
+/*
+ * Returns the scaling factor of a monitor with the given height in pixels and
+ * millimeters, in the same way the scaling factor of the root screen is
+ * computed, or 0 if its physical size is unknown (e.g. for projectors).
+ *
+ */
+static double monitor_scale(uint16_t pixels, uint32_t millimeters) {
+    if (millimeters == 0)
+        return 0;
+    const int dpi = (double)pixels * 25.4 / (double)millimeters;
+    return (dpi / 96.0);
+}
+
+/*
+ * Updates xr_resolutions, xr_scales and xr_screens from the active RandR monitors. The
+ * table is updated in place, and *changed is set if any monitor was added,
+ * removed, moved or resized.
+ *
+ * Returns false if RandR ≥ 1.5 is not available, in which case the caller
+ * needs to fall back to Xinerama.
+ *
+ */
+bool randr_query_monitors(bool *changed) {
+    *changed = false;
+
+    if (version_pending)
+        check_version();
+    if (!randr_active)
+        return false;
+
+    xcb_randr_get_monitors_reply_t *reply;
+    reply = ROUND_TRIP(xcb_randr_get_monitors_reply(conn, xcb_randr_get_monitors(conn, screen->root, true), NULL));
+    if (!reply) {
+        if (debug_mode)
+            fprintf(stderr, "Couldn't get RandR monitors\n");
+        return true;
+    }
+
+    int monitors = xcb_randr_get_monitors_monitors_length(reply);
+    if (monitors > xr_capacity) {
+        Rect *resolutions = realloc(xr_resolutions, monitors * sizeof(Rect));
+        double *scales = realloc(xr_scales, monitors * sizeof(double));
+        /* No memory? Just keep on using the old information. */
+        if (resolutions)
+            xr_resolutions = resolutions;
+        if (scales)
+            xr_scales = scales;
+        if (!resolutions || !scales) {
+            free(reply);
+            return true;
+        }
+        xr_capacity = monitors;
+    }
+
+    if (monitors != xr_screens)
+        *changed = true;
+
+    xcb_randr_monitor_info_iterator_t iter = xcb_randr_get_monitors_monitors_iterator(reply);
+    for (int monitor = 0; iter.rem; monitor++, xcb_randr_monitor_info_next(&iter)) {
+        Rect rect = {iter.data->x, iter.data->y, iter.data->width, iter.data->height};
+        double scale = monitor_scale(iter.data->height, iter.data->height_in_millimeters);
+        if (monitor < xr_screens &&
+            memcmp(&rect, &xr_resolutions[monitor], sizeof(Rect)) == 0 &&
+            xr_scales[monitor] == scale)
+            continue;
+
+        xr_resolutions[monitor] = rect;
+        xr_scales[monitor] = scale;
+        *changed = true;
+        DEBUG("found RandR monitor: %d x %d at %d x %d, scaling factor %.2f\n",
+              rect.width, rect.height, rect.x, rect.y, scale);
+    }
+    xr_screens = monitors;
+    if (monitors > 0)
+        monitors_seen = true;
+
+    free(reply);
+    return true;
+}
+
+/*
+ * Returns whether the given event type signals a change of the RandR
+ * configuration.
+ *
+ */
+bool randr_is_event(uint8_t type) {
+    return (randr_active &&
+            (type == randr_base_event + XCB_RANDR_SCREEN_CHANGE_NOTIFY ||
+             type == randr_base_event + XCB_RANDR_NOTIFY));
+}
+
+/*
+ * Returns whether every monitor was turned off or disconnected, i.e. RandR
+ * reports no active monitor anymore. Some X servers (e.g. headless ones, VNC
+ * or xrdp) never report a monitor at all, so this needs a transition from
+ * active monitors to none. Until then, the unlock indicator is drawn in the
+ * middle of the root window.
+ *
+ */
+bool randr_monitors_off(void) {
+    return (monitors_seen && xr_screens == 0);
+}
@@ -0,0 +1,12 @@
+#ifndef _RANDR_H
+#define _RANDR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+void randr_init(void);
+bool randr_query_monitors(bool *changed);
+bool randr_is_event(uint8_t type);
+bool randr_monitors_off(void);
+
+#endif
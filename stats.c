@@ -0,0 +1,239 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * See LICENSE for licensing information
+ *
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+/* The names of the metrics in the summary, indexed by stat_metric_t. */
+static const char *metric_names[STAT_COUNT] = {
+    "key to flush",
+    "render",
+    "PAM",
+    "grab",
+    "time to mapped",
+};
+
+/* The last STATS_RING_SIZE samples (in milliseconds) of every metric, and how
+ * many samples were recorded in total. */
+static double samples[STAT_COUNT][STATS_RING_SIZE];
+static unsigned int sample_count[STAT_COUNT];
+
+/* Where to append the summary to (--stats), NULL if disabled. */
+static char *stats_path;
+
+/* Start of i3lock, see stats_record_since_start(). */
+static double start_time;
+
+/* When the oldest key press which is not yet visible was received, or 0. */
+static double pending_key_time;
+
+/* The places which waited for a reply from the X server, see
+ * stats_round_trip_done(). Sites beyond MAX_ROUND_TRIP_SITES are only
+ * counted in round_trip_count. */
+#define MAX_ROUND_TRIP_SITES 32
+
+typedef struct round_trip_site {
+    const char *site;
+    unsigned int count;
+    double total_ms;
+    double max_ms;
+} round_trip_site_t;
+
+static round_trip_site_t round_trip_sites[MAX_ROUND_TRIP_SITES];
+static int round_trip_site_count;
+static unsigned int round_trip_count;
+static double round_trip_start;
+
+/*
+ * Remembers the start time of i3lock. Called first thing in main().
+ *
+ */
+void stats_init(void) {
+    start_time = stats_now();
+}
+
+/*
+ * Enables recording samples, the summary will be appended to the given file.
+ *
+ */
+void stats_enable(const char *path) {
+    free(stats_path);
+    stats_path = strdup(path);
+}
+
+bool stats_enabled(void) {
+    return (stats_path != NULL);
+}
+
+/*
+ * Returns the current time in milliseconds, from CLOCK_MONOTONIC.
+ *
+ */
+double stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*
+ * Records one sample of the given metric. Only touches the ring buffer, so it
+ * is cheap enough to be called on every frame.
+ *
+ */
+void stats_record(stat_metric_t metric, double ms) {
+    if (!stats_path)
+        return;
+
+    samples[metric][sample_count[metric] % STATS_RING_SIZE] = ms;
+    sample_count[metric]++;
+}
+
+void stats_record_since(stat_metric_t metric, double start) {
+    if (!stats_path)
+        return;
+
+    stats_record(metric, stats_now() - start);
+}
+
+void stats_record_since_start(stat_metric_t metric) {
+    stats_record_since(metric, start_time);
+}
+
+/*
+ * Called for every key press. Key presses which arrive before the previous one
+ * was shown count from the earliest one, since that is what the user waits
+ * for.
+ *
+ */
+void stats_key_received(void) {
+    if (!stats_path || pending_key_time != 0)
+        return;
+
+    pending_key_time = stats_now();
+}
+
+/*
+ * Called after a frame was flushed to the X server.
+ *
+ */
+void stats_frame_flushed(void) {
+    if (pending_key_time == 0)
+        return;
+
+    stats_record_since(STAT_KEY_TO_FLUSH, pending_key_time);
+    pending_key_time = 0;
+}
+
+/*
+ * Called right before waiting for a reply from the X server, see ROUND_TRIP().
+ *
+ */
+void stats_round_trip_start(void) {
+    round_trip_start = stats_now();
+}
+
+/*
+ * Called right after the reply arrived: records the round trip for the given
+ * call site and returns the reply. Round trips are always counted (they are
+ * rare enough for that), so that --timing can report them as well.
+ *
+ */
+void *stats_round_trip_done(const char *site, void *reply) {
+    const double ms = stats_now() - round_trip_start;
+    round_trip_count++;
+
+    int i;
+    for (i = 0; i < round_trip_site_count; i++)
+        if (strcmp(round_trip_sites[i].site, site) == 0)
+            break;
+    if (i == round_trip_site_count) {
+        if (i == MAX_ROUND_TRIP_SITES)
+            return reply;
+        round_trip_sites[round_trip_site_count++].site = site;
+    }
+
+    round_trip_site_t *entry = &round_trip_sites[i];
+    entry->count++;
+    entry->total_ms += ms;
+    if (ms > entry->max_ms)
+        entry->max_ms = ms;
+    return reply;
+}
+
+/*
+ * Returns the number of round trips to the X server so far.
+ *
+ */
+unsigned int stats_round_trips(void) {
+    return round_trip_count;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Returns the given percentile of the sorted samples (nearest rank).
+ *
+ */
+static double percentile(const double *sorted, unsigned int n, int p) {
+    unsigned int rank = (p * n + 99) / 100;
+    return sorted[(rank > 0 ? rank - 1 : 0)];
+}
+
+/*
+ * Appends a summary (count, p50, p99 and maximum) of all metrics to the file
+ * given with --stats, followed by the round trips to the X server per call
+ * site. Called on SIGUSR1 and before exiting.
+ *
+ */
+void stats_dump(void) {
+    if (!stats_path)
+        return;
+
+    FILE *file = fopen(stats_path, "a");
+    if (!file) {
+        perror("Could not open stats file");
+        return;
+    }
+
+    fprintf(file, "i3lock-color stats (pid %d)\n", getpid());
+    fprintf(file, "%-16s %8s %10s %10s %10s\n", "metric", "samples", "p50 ms", "p99 ms", "max ms");
+
+    double sorted[STATS_RING_SIZE];
+    for (int metric = 0; metric < STAT_COUNT; metric++) {
+        unsigned int n = (sample_count[metric] < STATS_RING_SIZE ? sample_count[metric] : STATS_RING_SIZE);
+        if (n == 0) {
+            fprintf(file, "%-16s %8d %10s %10s %10s\n", metric_names[metric], 0, "-", "-", "-");
+            continue;
+        }
+
+        memcpy(sorted, samples[metric], n * sizeof(double));
+        qsort(sorted, n, sizeof(double), compare_doubles);
+        fprintf(file, "%-16s %8u %10.3f %10.3f %10.3f\n",
+                metric_names[metric], sample_count[metric],
+                percentile(sorted, n, 50), percentile(sorted, n, 99), sorted[n - 1]);
+    }
+
+    fprintf(file, "%-24s %8s %10s %10s\n", "round trip", "count", "total ms", "max ms");
+    for (int i = 0; i < round_trip_site_count; i++)
+        fprintf(file, "%-24s %8u %10.3f %10.3f\n",
+                round_trip_sites[i].site, round_trip_sites[i].count,
+                round_trip_sites[i].total_ms, round_trip_sites[i].max_ms);
+    fprintf(file, "%-24s %8u\n", "all round trips", round_trip_count);
+
+    fclose(file);
+}
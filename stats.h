@@ -0,0 +1,48 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdbool.h>
+
+typedef enum {
+    STAT_KEY_TO_FLUSH = 0, /* key press received until its frame was flushed */
+    STAT_RENDER = 1,       /* drawing and submitting one frame */
+    STAT_PAM = 2,          /* one pam_authenticate() call */
+    STAT_GRAB = 3,         /* grabbing pointer and keyboard */
+    STAT_MAPPED = 4,       /* start of i3lock until the window was mapped */
+    STAT_COUNT
+} stat_metric_t;
+
+/* The number of samples kept per metric. Older samples are overwritten. */
+#define STATS_RING_SIZE 512
+
+#define STATS_STR(x) #x
+#define STATS_XSTR(x) STATS_STR(x)
+/* The call site of a round trip, e.g. "randr.c:117". */
+#define ROUND_TRIP_SITE (__FILE__ ":" STATS_XSTR(__LINE__))
+
+/* Evaluates to the given reply (e.g. "ROUND_TRIP(xcb_foo_reply(conn, cookie,
+ * NULL))"), and records how long waiting for it took, see
+ * stats_round_trip_done(). Only for the main thread. */
+#define ROUND_TRIP(reply) (stats_round_trip_start(), stats_round_trip_done(ROUND_TRIP_SITE, (reply)))
+
+/* Like ROUND_TRIP(), but only counts the wait if first is true. Replies to
+ * requests which were sent together arrive with the same round trip, so only
+ * the first wait of such a batch is one. Later replies of a batch which is
+ * always sent together just call the reply function. */
+#define ROUND_TRIP_IF(first, reply) ((first) ? ROUND_TRIP(reply) : (void *)(reply))
+
+void stats_init(void);
+void stats_enable(const char *path);
+bool stats_enabled(void);
+double stats_now(void);
+void stats_record(stat_metric_t metric, double ms);
+void stats_record_since(stat_metric_t metric, double start);
+void stats_record_since_start(stat_metric_t metric);
+void stats_key_received(void);
+void stats_frame_flushed(void);
+void stats_round_trip_start(void);
+void *stats_round_trip_done(const char *site, void *reply);
+unsigned int stats_round_trips(void);
+void stats_dump(void);
+
+#endif
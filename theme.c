@@ -0,0 +1,99 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * See LICENSE for licensing information
+ *
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <err.h>
+#include <xcb/xcb.h>
+
+#include "theme.h"
+#include "unlock_indicator.h"
+
+/*******************************************************************************
+ * Variables defined in i3lock.c.
+ ******************************************************************************/
+
+/* The background color to use (in hex). */
+extern char color[7];
+/* indicator color options */
+extern char insidevercolor[9];
+extern char insidewrongcolor[9];
+extern char insidecolor[9];
+extern char ringvercolor[9];
+extern char ringwrongcolor[9];
+extern char ringcolor[9];
+extern char linecolor[9];
+extern char textcolor[9];
+extern char keyhlcolor[9];
+extern char bshlcolor[9];
+extern char separatorcolor[9];
+extern int internal_line_source;
+
+theme_t theme;
+
+/*
+ * Parses a color given as rrggbb (or rrggbbaa if with_alpha is set). Exits
+ * if the color is invalid, just like the option parsing does.
+ *
+ */
+static rgba_t parse_color(const char *name, const char *hex, bool with_alpha) {
+    unsigned int red, green, blue, alpha = 255;
+    int expected = (with_alpha ? 4 : 3);
+
+    if (strlen(hex) != 2 * expected ||
+        sscanf(hex, "%02x%02x%02x%02x", &red, &green, &blue, &alpha) != expected)
+        errx(EXIT_FAILURE, "%s is invalid, color must be given in %s format\n",
+             name, (with_alpha ? "rrggbbaa" : "rrggbb"));
+
+    return (rgba_t){red / 255.0, green / 255.0, blue / 255.0, alpha / 255.0};
+}
+
+/*
+ * Returns the given color (without its alpha channel) as a pixel value for the
+ * X11 core protocol. Like background_pixel, this assumes a TrueColor visual
+ * with 8 bits per channel.
+ *
+ */
+uint32_t rgba_pixel(const rgba_t *color) {
+    return ((uint32_t)lround(color->red * 255) << 16) |
+           ((uint32_t)lround(color->green * 255) << 8) |
+           (uint32_t)lround(color->blue * 255);
+}
+
+/*
+ * Parses all colors into the global theme. Called once after the command line
+ * options were parsed, so that nothing needs to be parsed while drawing.
+ *
+ */
+void init_theme(void) {
+    theme.background = parse_color("color", color, false);
+    theme.background_pixel = strtoul(color, NULL, 16);
+
+    theme.inside[STATE_PAM_IDLE] = parse_color("insidecolor", insidecolor, true);
+    theme.inside[STATE_PAM_VERIFY] = parse_color("insidevercolor", insidevercolor, true);
+    theme.inside[STATE_PAM_WRONG] = parse_color("insidewrongcolor", insidewrongcolor, true);
+
+    theme.ring[STATE_PAM_IDLE] = parse_color("ringcolor", ringcolor, true);
+    theme.ring[STATE_PAM_VERIFY] = parse_color("ringvercolor", ringvercolor, true);
+    theme.ring[STATE_PAM_WRONG] = parse_color("ringwrongcolor", ringwrongcolor, true);
+
+    /* default is to use the supplied line color, 1 will be ring color, 2 will
+     * be to use the inside color (i.e. no line is drawn at all) */
+    rgba_t line = parse_color("linecolor", linecolor, true);
+    for (int state = 0; state < 3; state++)
+        theme.line[state] = (internal_line_source == 1 ? theme.ring[state] : line);
+    theme.draw_line = (internal_line_source != 2);
+
+    theme.text = parse_color("textcolor", textcolor, true);
+    theme.key_highlight = parse_color("keyhlcolor", keyhlcolor, true);
+    theme.backspace_highlight = parse_color("bshlcolor", bshlcolor, true);
+    theme.separator = parse_color("separatorcolor", separatorcolor, true);
+}
@@ -0,0 +1,40 @@
+#ifndef _THEME_H
+#define _THEME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct rgba {
+    double red;
+    double green;
+    double blue;
+    double alpha;
+} rgba_t;
+
+/* The colors to draw with, parsed once from the hex strings given on the
+ * command line. The colors which depend on the PAM state are indexed by
+ * pam_state_t. */
+typedef struct theme {
+    rgba_t background;
+    /* The background color as a pixel value for the X11 core protocol. */
+    uint32_t background_pixel;
+
+    rgba_t inside[3];
+    rgba_t ring[3];
+    /* The separator line between inside and ring. Already resolved according
+     * to --line-uses-ring, and not drawn at all with --line-uses-inside. */
+    rgba_t line[3];
+    bool draw_line;
+
+    rgba_t text;
+    rgba_t key_highlight;
+    rgba_t backspace_highlight;
+    rgba_t separator;
+} theme_t;
+
+extern theme_t theme;
+
+void init_theme(void);
+uint32_t rgba_pixel(const rgba_t *color);
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * vim:ts=4:sw=4:expandtab
+ *
+ * © 2010 Michael Stapelberg
+ *
+ * threadpool.c: a fixed pool of worker threads (one per core) for the
+ *               CPU-heavy parts of rendering, like blurring and scaling the
+ *               background. The threads are started on first use and then
+ *               wait for work, so that no thread is created per frame.
+ *
+ * See LICENSE for licensing information
+ *
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "threadpool.h"
+
+/* Upper bound for the number of threads, including the calling one. */
+#define MAX_THREADS 16
+
+static pthread_t threads[MAX_THREADS];
+/* The number of threads working on a batch, including the calling one, and
+ * the process they were started in. Threads do not survive fork(), so the
+ * pool is started again in the child. */
+static int thread_count;
+static pid_t pool_pid;
+
+/* Serializes the callers of threadpool_run(), which might be the main thread
+ * and the decode thread at the same time. */
+static pthread_mutex_t run_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The current batch. Protected by lock, work is signaled when a batch starts
+ * (or generation changes), done when its last task finished. */
+static pthread_mutex_t lock;
+static pthread_cond_t work;
+static pthread_cond_t done;
+static threadpool_task_t batch_task;
+static void *batch_arg;
+static int batch_count;
+static int next_index;
+static int unfinished;
+static unsigned int generation;
+
+/*
+ * Runs tasks of the current batch until none are left. Called with lock held.
+ *
+ */
+static void work_on_batch(void) {
+    while (next_index < batch_count) {
+        int index = next_index++;
+        pthread_mutex_unlock(&lock);
+        batch_task(batch_arg, index);
+        pthread_mutex_lock(&lock);
+        if (--unfinished == 0)
+            pthread_cond_broadcast(&done);
+    }
+}
+
+static void *worker(void *arg) {
+    unsigned int seen = 0;
+
+    pthread_mutex_lock(&lock);
+    while (true) {
+        while (generation == seen)
+            pthread_cond_wait(&work, &lock);
+        seen = generation;
+        work_on_batch();
+    }
+    return NULL;
+}
+
+/*
+ * Starts the worker threads, one less than there are cores since the calling
+ * thread works as well. If threads cannot be created, the pool just has fewer
+ * of them (down to running everything in the calling thread).
+ *
+ */
+static void start_pool(void) {
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&work, NULL);
+    pthread_cond_init(&done, NULL);
+    generation = 0;
+    pool_pid = getpid();
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int wanted = (cores < 1 ? 1 : (cores > MAX_THREADS ? MAX_THREADS : (int)cores));
+    thread_count = 1;
+    while (thread_count < wanted &&
+           pthread_create(&threads[thread_count - 1], NULL, worker, NULL) == 0)
+        thread_count++;
+}
+
+/*
+ * Returns the number of threads working on a batch, which is a good number of
+ * parts to split work into.
+ *
+ */
+int threadpool_size(void) {
+    pthread_mutex_lock(&run_lock);
+    if (pool_pid != getpid())
+        start_pool();
+    int size = thread_count;
+    pthread_mutex_unlock(&run_lock);
+    return size;
+}
+
+/*
+ * Runs task(arg, index) for every index in [0, count) on the pool, in no
+ * particular order, and returns once all of them are finished. The calling
+ * thread runs tasks as well.
+ *
+ */
+void threadpool_run(threadpool_task_t task, void *arg, int count) {
+    if (count < 1)
+        return;
+
+    pthread_mutex_lock(&run_lock);
+    if (pool_pid != getpid())
+        start_pool();
+
+    pthread_mutex_lock(&lock);
+    batch_task = task;
+    batch_arg = arg;
+    batch_count = count;
+    next_index = 0;
+    unfinished = count;
+    if (thread_count > 1 && count > 1) {
+        generation++;
+        pthread_cond_broadcast(&work);
+    }
+
+    work_on_batch();
+    while (unfinished > 0)
+        pthread_cond_wait(&done, &lock);
+    pthread_mutex_unlock(&lock);
+
+    pthread_mutex_unlock(&run_lock);
+}
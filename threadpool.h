@@ -0,0 +1,10 @@
+#ifndef _THREADPOOL_H
+#define _THREADPOOL_H
+
+/* A task is run once for every index in [0, count), see threadpool_run(). */
+typedef void (*threadpool_task_t)(void *arg, int index);
+
+int threadpool_size(void);
+void threadpool_run(threadpool_task_t task, void *arg, int count);
+
+#endif
@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <err.h>
 #include <xcb/xcb.h>
 #include <ev.h>
 #include <cairo.h>
@@ -20,12 +21,27 @@
 #include "xcb.h"
 #include "unlock_indicator.h"
 #include "xinerama.h"
+#include "theme.h"
+#include "stats.h"
+#include "bgcache.h"
+#include "present.h"
+#include "anim.h"
+#include "power.h"
+#include "threadpool.h"
 
 #define BUTTON_RADIUS 90
 #define BUTTON_SPACE (BUTTON_RADIUS + 5)
 #define BUTTON_CENTER (BUTTON_RADIUS + 5)
 #define BUTTON_DIAMETER (2 * BUTTON_SPACE)
 
+/* Number of distinct positions for the highlighted part of the ring. */
+#define HIGHLIGHT_STEPS 16
+
+/* How long (in milliseconds) the unlock indicator takes to fade in or out. */
+#define FADE_DURATION 150
+/* How long (in milliseconds) the spinner takes for one turn while verifying. */
+#define SPINNER_PERIOD 800
+
 /*******************************************************************************
  * Variables defined in i3lock.c.
  ******************************************************************************/
@@ -53,21 +69,17 @@ extern cairo_surface_t *img;
 
 /* Whether the image should be tiled. */
 extern bool tile;
-/* The background color to use (in hex). */
-extern char color[7];
-/* indicator color options */
-extern char insidevercolor[9];
-extern char insidewrongcolor[9];
-extern char insidecolor[9];
-extern char ringvercolor[9];
-extern char ringwrongcolor[9];
-extern char ringcolor[9];
-extern char linecolor[9];
-extern char textcolor[9];
-extern char keyhlcolor[9];
-extern char bshlcolor[9];
-extern char separatorcolor[9];
-extern int internal_line_source;
+
+/* How the image is placed on each monitor (--image-mode). */
+extern image_mode_t image_mode;
+
+/* The font family for the text of the unlock indicator (--font), NULL for
+ * cairo's default. */
+extern char *font_name;
+
+/* Whether to draw the unlock indicator with core X11 requests instead of
+ * compositing sprites (--core-indicator). */
+extern bool core_indicator;
 
 extern int screen_number;
 
@@ -95,159 +107,487 @@ static xcb_visualtype_t *vistype;
 unlock_state_t unlock_state;
 pam_state_t pam_state;
 
+/* The background (image or fill color), rendered once per resolution into a
+ * server-side pixmap. Every frame starts out as a copy of it, so that the image
+ * is only sent to the X server again when the resolution changes. */
+static xcb_pixmap_t bg_cache = XCB_NONE;
+static uint32_t bg_cache_resolution[2];
+
+/* Graphics context used to copy the cached background into the frame. */
+static xcb_gcontext_t bg_gc = XCB_NONE;
+
+/* The frame pixmaps. With the Present extension, frames are drawn into the
+ * two of them alternately (the back buffer, buffers[back]) while the X server
+ * shows the other one. Without it, only buffers[0] is used and set as the
+ * background of the lock window. They are kept around so that redraws only
+ * need to update the damaged parts. A buffer is valid if it contains the
+ * frame before the previous one (or, with one buffer, the previous one). */
+static struct {
+    xcb_pixmap_t pixmap;
+    bool valid;
+} buffers[2] = {{XCB_NONE, false}, {XCB_NONE, false}};
+static int back;
+static uint32_t bg_pixmap_resolution[2];
+
+/* The frame pixmap which is being drawn into, buffers[back].pixmap. */
+static xcb_pixmap_t bg_pixmap = XCB_NONE;
+
+/* Whether the next redraw_screen() needs to repaint the whole frame instead of
+ * only the areas of the unlock indicators. */
+static bool screen_damaged = true;
+
+/* The areas of the unlock indicators in the current and in the previous
+ * frame. When the indicators move (e.g. because a monitor was reconfigured),
+ * the previous areas need to be restored as well. */
+static xcb_rectangle_t *drawn_rects;
+static xcb_rectangle_t *previous_rects;
+static int drawn_count;
+static int previous_count;
+static int rects_capacity;
+
+/* The areas which the last partial frame updated, see redraw_screen(), and
+ * the ones which the frame before updated. A back buffer which is two frames
+ * old needs both of them restored. */
+static xcb_rectangle_t *damaged_rects;
+static xcb_rectangle_t *previous_damaged_rects;
+static int damaged_count;
+static int previous_damaged_count;
+
+/* The graphics context and font for --core-indicator, created on first use.
+ * core_font stays XCB_NONE if the font could not be opened, in which case the
+ * text is not drawn. */
+static xcb_gcontext_t core_gc = XCB_NONE;
+static xcb_font_t core_font = XCB_NONE;
+static int core_char_width;
+static int core_font_ascent;
+static int core_font_descent;
+
+/* The font face for font_name. It is looked up once, since a fontconfig lookup
+ * is more expensive than rendering the text itself. */
+static cairo_font_face_t *font_face;
+
+/* Whether the state changed since the last frame, see schedule_redraw(). */
+static bool redraw_scheduled;
+
+/* The position (in HIGHLIGHT_STEPS) of the highlighted part of the ring. */
+static int highlight_step;
+
+/* Whether the unlock indicator is shown (or fading in), see
+ * update_animations(). */
+static bool indicator_shown;
+
+/* The layers the unlock indicator is composited from. */
+typedef enum {
+    LAYER_RING = 0,           /* inside, ring and separator line */
+    LAYER_KEY_HIGHLIGHT = 1,  /* highlighted part of the ring for keys */
+    LAYER_BACKSPACE_HIGHLIGHT = 2,
+    LAYER_TEXT = 3            /* PAM state, failed attempts, modifiers */
+} indicator_layer_t;
+
+/* The number of texts kept per scaling factor. This covers switching between
+ * "verifying…", "wrong!" and the failed attempts without rendering again. */
+#define TEXT_SPRITES 4
+
+/* A pre-rendered text (see LAYER_TEXT), with what it shows. */
+typedef struct text_sprite {
+    cairo_surface_t *surface;
+    char text[16];
+    char *modifiers;
+    /* For evicting the least recently used text, see get_text_sprite(). */
+    unsigned int last_used;
+} text_sprite_t;
+
+/* Pre-rendered layers of the unlock indicator for one scaling factor, kept in
+ * server-side pixmaps of diameter × diameter pixels: one ring per PAM state,
+ * one highlight per kind (key/backspace) and position, and the recent texts. */
+typedef struct sprite_set {
+    double scale;
+    int diameter;
+    cairo_surface_t *ring[3];
+    cairo_surface_t *highlight[2][HIGHLIGHT_STEPS];
+    text_sprite_t texts[TEXT_SPRITES];
+} sprite_set_t;
+
+/* One sprite set per distinct scaling factor of the monitors, so that every
+ * monitor gets an unlock indicator rendered at its native size. */
+static sprite_set_t *sprite_sets;
+static int sprite_set_count;
+static int sprite_set_capacity;
+
 /*
- * Returns the scaling factor of the current screen. E.g., on a 227 DPI MacBook
- * Pro 13" Retina screen, the scaling factor is 227/96 = 2.36.
+ * Returns the scaling factor of the root screen, which is used for monitors
+ * whose physical size is unknown. E.g., on a 227 DPI MacBook Pro 13" Retina
+ * screen, the scaling factor is 227/96 = 2.36.
  *
  */
-static double scaling_factor(void) {
-    const int dpi = (double)screen->height_in_pixels * 25.4 /
-                    (double)screen->height_in_millimeters;
-    return (dpi / 96.0);
+static double root_scaling_factor(void) {
+    static double scale = 0;
+    if (scale == 0) {
+        if (screen->height_in_millimeters == 0)
+            return (scale = 1.0);
+        const int dpi = (double)screen->height_in_pixels * 25.4 /
+                        (double)screen->height_in_millimeters;
+        scale = (dpi / 96.0);
+    }
+    return scale;
 }
 
 /*
- * Draws global image with fill color onto a pixmap with the given
- * resolution and returns it.
+ * Returns a new image surface for the pixels of the given one, which needs to
+ * be flushed and must not change while it is in use. Every thread pool job
+ * uses its own: cairo references the pixman image of a source surface while
+ * painting it, and that reference count is not atomic.
  *
  */
-xcb_pixmap_t draw_image(uint32_t *resolution) {
-    xcb_pixmap_t bg_pixmap = XCB_NONE;
-    int button_diameter_physical = ceil(scaling_factor() * BUTTON_DIAMETER);
-    DEBUG("scaling_factor is %.f, physical diameter is %d px\n",
-          scaling_factor(), button_diameter_physical);
+static cairo_surface_t *share_image(cairo_surface_t *surface) {
+    return cairo_image_surface_create_for_data(cairo_image_surface_get_data(surface),
+                                               cairo_image_surface_get_format(surface),
+                                               cairo_image_surface_get_width(surface),
+                                               cairo_image_surface_get_height(surface),
+                                               cairo_image_surface_get_stride(surface));
+}
 
-    if (!vistype)
-        vistype = get_root_visual_type(screen);
-    bg_pixmap = create_bg_pixmap(conn, screen, resolution, color);
-    /* Initialize cairo: Create one in-memory surface to render the unlock
-     * indicator on, create one XCB surface to actually draw (one or more,
-     * depending on the amount of screens) unlock indicators on. */
-    cairo_surface_t *output = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, button_diameter_physical, button_diameter_physical);
-    cairo_t *ctx = cairo_create(output);
+/*
+ * Returns a copy of the given image, resampled for a monitor of the given size
+ * according to image_mode, and the offset to paint it at within the monitor.
+ *
+ */
+static cairo_surface_t *scale_image(cairo_surface_t *image, int width, int height, int *x, int *y) {
+    const int img_width = cairo_image_surface_get_width(image);
+    const int img_height = cairo_image_surface_get_height(image);
+    double scale_x = (double)width / img_width;
+    double scale_y = (double)height / img_height;
 
-    cairo_surface_t *xcb_output = cairo_xcb_surface_create(conn, bg_pixmap, vistype, resolution[0], resolution[1]);
-    cairo_t *xcb_ctx = cairo_create(xcb_output);
+    switch (image_mode) {
+        case IMAGE_MODE_FILL:
+            scale_x = scale_y = fmax(scale_x, scale_y);
+            break;
+        case IMAGE_MODE_FIT:
+            scale_x = scale_y = fmin(scale_x, scale_y);
+            break;
+        case IMAGE_MODE_STRETCH:
+            break;
+        default:
+            scale_x = scale_y = 1.0;
+            break;
+    }
+
+    /* The copy never needs to be larger than the monitor, the parts which
+     * would be cropped are not resampled at all. */
+    const int scaled_width = fmin(width, ceil(img_width * scale_x));
+    const int scaled_height = fmin(height, ceil(img_height * scale_y));
+    *x = (width - scaled_width) / 2;
+    *y = (height - scaled_height) / 2;
+
+    cairo_surface_t *scaled = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, scaled_width, scaled_height);
+    cairo_t *ctx = cairo_create(scaled);
+    cairo_translate(ctx, (scaled_width - img_width * scale_x) / 2, (scaled_height - img_height * scale_y) / 2);
+    cairo_scale(ctx, scale_x, scale_y);
+    cairo_set_source_surface(ctx, image, 0, 0);
+    cairo_pattern_set_filter(cairo_get_source(ctx), CAIRO_FILTER_GOOD);
+    cairo_set_operator(ctx, CAIRO_OPERATOR_SOURCE);
+    cairo_paint(ctx);
+    cairo_destroy(ctx);
+    cairo_surface_flush(scaled);
+
+    return scaled;
+}
+
+/* What paint_image_per_monitor() does for one monitor, on the thread pool. */
+typedef struct monitor_tile {
+    /* The first monitor of the same size, whose resampled copy is shared. */
+    int first;
+    /* The resampled copy (for first monitors only) and its offset within the
+     * monitor. */
+    cairo_surface_t *scaled;
+    int x;
+    int y;
+} monitor_tile_t;
 
-    if (img) {
-        if (!tile) {
-            cairo_set_source_surface(xcb_ctx, img, 0, 0);
-            cairo_paint(xcb_ctx);
+typedef struct monitor_jobs {
+    const Rect *monitors;
+    monitor_tile_t *tiles;
+    /* The monitors which need a resampled copy of their own. */
+    int *distinct;
+    /* The pixels to paint into, for paint_tile(). */
+    uint8_t *data;
+    cairo_format_t format;
+    int width;
+    int height;
+    int stride;
+} monitor_jobs_t;
+
+static void scale_tile(void *arg, int index) {
+    monitor_jobs_t *jobs = arg;
+    const int i = jobs->distinct[index];
+    monitor_tile_t *tile = &jobs->tiles[i];
+    cairo_surface_t *image = share_image(img);
+    tile->scaled = scale_image(image, jobs->monitors[i].width, jobs->monitors[i].height, &tile->x, &tile->y);
+    cairo_surface_destroy(image);
+}
+
+/*
+ * Paints the resampled copy onto its monitor, through an image surface for
+ * just the pixels of the monitor, so that the monitors can be painted in
+ * parallel. Monitors of the same size share the copy, so each one paints it
+ * through its own surface, see share_image().
+ *
+ */
+static void paint_tile(void *arg, int index) {
+    monitor_jobs_t *jobs = arg;
+    const monitor_tile_t *tile = &jobs->tiles[jobs->tiles[index].first];
+    const int x = jobs->monitors[index].x + tile->x;
+    const int y = jobs->monitors[index].y + tile->y;
+    const int x0 = (x < 0 ? 0 : x);
+    const int y0 = (y < 0 ? 0 : y);
+    const int x1 = fmin(jobs->width, x + cairo_image_surface_get_width(tile->scaled));
+    const int y1 = fmin(jobs->height, y + cairo_image_surface_get_height(tile->scaled));
+    if (x1 <= x0 || y1 <= y0)
+        return;
+
+    cairo_surface_t *part = cairo_image_surface_create_for_data(jobs->data + y0 * jobs->stride + 4 * x0,
+                                                                jobs->format, x1 - x0, y1 - y0, jobs->stride);
+    cairo_surface_t *scaled = share_image(tile->scaled);
+    cairo_t *ctx = cairo_create(part);
+    cairo_set_source_surface(ctx, scaled, x - x0, y - y0);
+    cairo_paint(ctx);
+    cairo_destroy(ctx);
+    cairo_surface_destroy(scaled);
+    cairo_surface_destroy(part);
+}
+
+/*
+ * Returns whether any two of the given monitors overlap, in which case they
+ * cannot be painted in parallel.
+ *
+ */
+static bool monitors_overlap(const Rect *monitors, int count) {
+    for (int i = 0; i < count; i++)
+        for (int j = i + 1; j < count; j++)
+            if (monitors[i].x < monitors[j].x + monitors[j].width &&
+                monitors[j].x < monitors[i].x + monitors[i].width &&
+                monitors[i].y < monitors[j].y + monitors[j].height &&
+                monitors[j].y < monitors[i].y + monitors[i].height)
+                return true;
+    return false;
+}
+
+/*
+ * Paints the global image onto each monitor according to image_mode. Monitors
+ * of the same size share one resampled copy, so the image is resampled at most
+ * once per distinct monitor size. The copies are resampled in parallel, and
+ * painted in parallel as well when drawing into client-side memory (which is
+ * the case with MIT-SHM).
+ *
+ */
+static void paint_image_per_monitor(cairo_t *ctx, uint32_t *resolution) {
+    Rect root = {0, 0, resolution[0], resolution[1]};
+    const Rect *monitors = (xr_screens > 0 ? xr_resolutions : &root);
+    const int count = (xr_screens > 0 ? xr_screens : 1);
+
+    monitor_tile_t *tiles = calloc(count, sizeof(monitor_tile_t));
+    int *distinct = calloc(count, sizeof(int));
+    if (!tiles || !distinct)
+        err(EXIT_FAILURE, "Could not allocate memory for the background");
+
+    int distinct_count = 0;
+    for (int i = 0; i < count; i++) {
+        tiles[i].first = i;
+        for (int j = 0; j < i; j++) {
+            if (monitors[j].width == monitors[i].width &&
+                monitors[j].height == monitors[i].height) {
+                tiles[i].first = tiles[j].first;
+                break;
+            }
+        }
+        if (tiles[i].first == i)
+            distinct[distinct_count++] = i;
+    }
+
+    monitor_jobs_t jobs = {.monitors = monitors, .tiles = tiles, .distinct = distinct};
+    /* The jobs only read the pixels of img. */
+    cairo_surface_flush(img);
+    threadpool_run(scale_tile, &jobs, distinct_count);
+
+    cairo_surface_t *target = cairo_get_target(ctx);
+    if (cairo_surface_get_type(target) == CAIRO_SURFACE_TYPE_IMAGE &&
+        !monitors_overlap(monitors, count)) {
+        cairo_surface_flush(target);
+        jobs.data = cairo_image_surface_get_data(target);
+        jobs.format = cairo_image_surface_get_format(target);
+        jobs.width = cairo_image_surface_get_width(target);
+        jobs.height = cairo_image_surface_get_height(target);
+        jobs.stride = cairo_image_surface_get_stride(target);
+        threadpool_run(paint_tile, &jobs, count);
+        cairo_surface_mark_dirty(target);
+    } else {
+        for (int i = 0; i < count; i++) {
+            const monitor_tile_t *tile = &tiles[tiles[i].first];
+            const int x = monitors[i].x + tile->x;
+            const int y = monitors[i].y + tile->y;
+            cairo_set_source_surface(ctx, tile->scaled, x, y);
+            cairo_rectangle(ctx, x, y,
+                            cairo_image_surface_get_width(tile->scaled),
+                            cairo_image_surface_get_height(tile->scaled));
+            cairo_fill(ctx);
+        }
+    }
+
+    for (int i = 0; i < distinct_count; i++)
+        cairo_surface_destroy(tiles[distinct[i]].scaled);
+    free(tiles);
+    free(distinct);
+}
+
+/*
+ * Paints the global image onto the given context, tiled or placed on each
+ * monitor if requested.
+ *
+ */
+static void paint_image(cairo_t *ctx, uint32_t *resolution) {
+    if (image_mode != IMAGE_MODE_NONE) {
+        paint_image_per_monitor(ctx, resolution);
+    } else if (!tile) {
+        cairo_set_source_surface(ctx, img, 0, 0);
+        cairo_paint(ctx);
+    } else {
+        /* create a pattern and fill a rectangle as big as the screen */
+        cairo_pattern_t *pattern;
+        pattern = cairo_pattern_create_for_surface(img);
+        cairo_set_source(ctx, pattern);
+        cairo_pattern_set_extend(pattern, CAIRO_EXTEND_REPEAT);
+        cairo_rectangle(ctx, 0, 0, resolution[0], resolution[1]);
+        cairo_fill(ctx);
+        cairo_pattern_destroy(pattern);
+    }
+}
+
+/*
+ * Renders the global image (or the fill color) onto a new pixmap with the
+ * given resolution and keeps it as the background cache.
+ *
+ * When possible, the background is composed into a shared memory segment and
+ * copied into the pixmap by the X server. Otherwise, cairo sends the image
+ * over the socket with PutImage, which takes long for big images.
+ *
+ */
+static void render_background(uint32_t *resolution) {
+    DEBUG("rendering background for %d x %d\n", resolution[0], resolution[1]);
+
+    /* create_bg_pixmap() already fills the pixmap with the background color,
+     * which is all we need when there is no image. */
+    bg_cache = create_bg_pixmap(conn, screen, resolution, theme.background_pixel);
+    bg_cache_resolution[0] = resolution[0];
+    bg_cache_resolution[1] = resolution[1];
+
+    /* A background rendered by an earlier i3lock for the same image and
+     * screen layout saves decoding and scaling the image. */
+    cairo_surface_t *cached = bgcache_load(resolution);
+    if (!cached && !img) {
+        /* With a cached background (or --low-memory), the image might not be
+         * decoded (anymore). If the layout changed since, we need it after
+         * all. */
+        request_image_decode();
+        return;
+    }
+
+    shm_image_t shm;
+    if (create_shm_image(conn, screen, resolution[0], resolution[1], false, &shm)) {
+        cairo_surface_t *output = cairo_image_surface_create_for_data(shm.data, CAIRO_FORMAT_RGB24, shm.width, shm.height, shm.stride);
+        cairo_t *ctx = cairo_create(output);
+
+        if (cached) {
+            cairo_set_operator(ctx, CAIRO_OPERATOR_SOURCE);
+            cairo_set_source_surface(ctx, cached, 0, 0);
+            cairo_paint(ctx);
         } else {
-            /* create a pattern and fill a rectangle as big as the screen */
-            cairo_pattern_t *pattern;
-            pattern = cairo_pattern_create_for_surface(img);
-            cairo_set_source(xcb_ctx, pattern);
-            cairo_pattern_set_extend(pattern, CAIRO_EXTEND_REPEAT);
-            cairo_rectangle(xcb_ctx, 0, 0, resolution[0], resolution[1]);
-            cairo_fill(xcb_ctx);
-            cairo_pattern_destroy(pattern);
+            cairo_set_source_rgb(ctx, theme.background.red, theme.background.green, theme.background.blue);
+            cairo_paint(ctx);
+            paint_image(ctx, resolution);
         }
+
+        cairo_destroy(ctx);
+        cairo_surface_flush(output);
+        if (!cached)
+            bgcache_store(output, resolution);
+        cairo_surface_destroy(output);
+
+        put_shm_image(conn, bg_cache, bg_gc, &shm);
+        free_shm_image(conn, &shm);
+        if (cached)
+            cairo_surface_destroy(cached);
+        return;
+    }
+
+    cairo_surface_t *xcb_output = cairo_xcb_surface_create(conn, bg_cache, vistype, resolution[0], resolution[1]);
+    cairo_t *xcb_ctx = cairo_create(xcb_output);
+
+    if (cached) {
+        cairo_set_source_surface(xcb_ctx, cached, 0, 0);
+        cairo_paint(xcb_ctx);
+        cairo_surface_destroy(cached);
     } else {
-        char strgroups[3][3] = {{color[0], color[1], '\0'},
-                                {color[2], color[3], '\0'},
-                                {color[4], color[5], '\0'}};
-        uint32_t rgb16[3] = {(strtol(strgroups[0], NULL, 16)),
-                             (strtol(strgroups[1], NULL, 16)),
-                             (strtol(strgroups[2], NULL, 16))};
-        cairo_set_source_rgb(xcb_ctx, rgb16[0] / 255.0, rgb16[1] / 255.0, rgb16[2] / 255.0);
-        cairo_rectangle(xcb_ctx, 0, 0, resolution[0], resolution[1]);
-        cairo_fill(xcb_ctx);
-    }
-
-    /* build indicator color arrays */
-    char strgroupsiv[4][3] = {{insidevercolor[0], insidevercolor[1], '\0'},
-                              {insidevercolor[2], insidevercolor[3], '\0'},
-                              {insidevercolor[4], insidevercolor[5], '\0'},
-                              {insidevercolor[6], insidevercolor[7], '\0'}};
-    uint32_t insidever16[4] = {(strtol(strgroupsiv[0], NULL, 16)),
-                               (strtol(strgroupsiv[1], NULL, 16)),
-                               (strtol(strgroupsiv[2], NULL, 16)),
-                               (strtol(strgroupsiv[3], NULL, 16))};
-    char strgroupsiw[4][3] = {{insidewrongcolor[0], insidewrongcolor[1], '\0'},
-                              {insidewrongcolor[2], insidewrongcolor[3], '\0'},
-                              {insidewrongcolor[4], insidewrongcolor[5], '\0'},
-                              {insidewrongcolor[6], insidewrongcolor[7], '\0'}};
-    uint32_t insidewrong16[4] = {(strtol(strgroupsiw[0], NULL, 16)),
-                                 (strtol(strgroupsiw[1], NULL, 16)),
-                                 (strtol(strgroupsiw[2], NULL, 16)),
-                                 (strtol(strgroupsiw[3], NULL, 16))};
-    char strgroupsi[4][3] = {{insidecolor[0], insidecolor[1], '\0'},
-                             {insidecolor[2], insidecolor[3], '\0'},
-                             {insidecolor[4], insidecolor[5], '\0'},
-                             {insidecolor[6], insidecolor[7], '\0'}};
-    uint32_t inside16[4] = {(strtol(strgroupsi[0], NULL, 16)),
-                            (strtol(strgroupsi[1], NULL, 16)),
-                            (strtol(strgroupsi[2], NULL, 16)),
-                            (strtol(strgroupsi[3], NULL, 16))};
-    char strgroupsrv[4][3] = {{ringvercolor[0], ringvercolor[1], '\0'},
-                              {ringvercolor[2], ringvercolor[3], '\0'},
-                              {ringvercolor[4], ringvercolor[5], '\0'},
-                              {ringvercolor[6], ringvercolor[7], '\0'}};
-    uint32_t ringver16[4] = {(strtol(strgroupsrv[0], NULL, 16)),
-                             (strtol(strgroupsrv[1], NULL, 16)),
-                             (strtol(strgroupsrv[2], NULL, 16)),
-                             (strtol(strgroupsrv[3], NULL, 16))};
-    char strgroupsrw[4][3] = {{ringwrongcolor[0], ringwrongcolor[1], '\0'},
-                              {ringwrongcolor[2], ringwrongcolor[3], '\0'},
-                              {ringwrongcolor[4], ringwrongcolor[5], '\0'},
-                              {ringwrongcolor[6], ringwrongcolor[7], '\0'}};
-    uint32_t ringwrong16[4] = {(strtol(strgroupsrw[0], NULL, 16)),
-                               (strtol(strgroupsrw[1], NULL, 16)),
-                               (strtol(strgroupsrw[2], NULL, 16)),
-                               (strtol(strgroupsrw[3], NULL, 16))};
-    char strgroupsr[4][3] = {{ringcolor[0], ringcolor[1], '\0'},
-                             {ringcolor[2], ringcolor[3], '\0'},
-                             {ringcolor[4], ringcolor[5], '\0'},
-                             {ringcolor[6], ringcolor[7], '\0'}};
-    uint32_t ring16[4] = {(strtol(strgroupsr[0], NULL, 16)),
-                          (strtol(strgroupsr[1], NULL, 16)),
-                          (strtol(strgroupsr[2], NULL, 16)),
-                          (strtol(strgroupsr[3], NULL, 16))};
-    char strgroupsl[4][3] = {{linecolor[0], linecolor[1], '\0'},
-                             {linecolor[2], linecolor[3], '\0'},
-                             {linecolor[4], linecolor[5], '\0'},
-                             {linecolor[6], linecolor[7], '\0'}};
-    uint32_t line16[4] = {(strtol(strgroupsl[0], NULL, 16)),
-                          (strtol(strgroupsl[1], NULL, 16)),
-                          (strtol(strgroupsl[2], NULL, 16)),
-                          (strtol(strgroupsl[3], NULL, 16))};
-    char strgroupst[4][3] = {{textcolor[0], textcolor[1], '\0'},
-                             {textcolor[2], textcolor[3], '\0'},
-                             {textcolor[4], textcolor[5], '\0'},
-                             {textcolor[6], textcolor[7], '\0'}};
-    uint32_t text16[4] = {(strtol(strgroupst[0], NULL, 16)),
-                          (strtol(strgroupst[1], NULL, 16)),
-                          (strtol(strgroupst[2], NULL, 16)),
-                          (strtol(strgroupst[3], NULL, 16))};
-    char strgroupsk[4][3] = {{keyhlcolor[0], keyhlcolor[1], '\0'},
-                             {keyhlcolor[2], keyhlcolor[3], '\0'},
-                             {keyhlcolor[4], keyhlcolor[5], '\0'},
-                             {keyhlcolor[6], keyhlcolor[7], '\0'}};
-    uint32_t keyhl16[4] = {(strtol(strgroupsk[0], NULL, 16)),
-                           (strtol(strgroupsk[1], NULL, 16)),
-                           (strtol(strgroupsk[2], NULL, 16)),
-                           (strtol(strgroupsk[3], NULL, 16))};
-    char strgroupsb[4][3] = {{bshlcolor[0], bshlcolor[1], '\0'},
-                             {bshlcolor[2], bshlcolor[3], '\0'},
-                             {bshlcolor[4], bshlcolor[5], '\0'},
-                             {bshlcolor[6], bshlcolor[7], '\0'}};
-    uint32_t bshl16[4] = {(strtol(strgroupsb[0], NULL, 16)),
-                          (strtol(strgroupsb[1], NULL, 16)),
-                          (strtol(strgroupsb[2], NULL, 16)),
-                          (strtol(strgroupsb[3], NULL, 16))};
-    char strgroupss[4][3] = {{separatorcolor[0], separatorcolor[1], '\0'},
-                             {separatorcolor[2], separatorcolor[3], '\0'},
-                             {separatorcolor[4], separatorcolor[5], '\0'},
-                             {separatorcolor[6], separatorcolor[7], '\0'}};
-    uint32_t sep16[4] = {(strtol(strgroupss[0], NULL, 16)),
-                          (strtol(strgroupss[1], NULL, 16)),
-                          (strtol(strgroupss[2], NULL, 16)),
-                          (strtol(strgroupss[3], NULL, 16))};
-
-    if (unlock_indicator &&
-        (unlock_state >= STATE_KEY_PRESSED || pam_state > STATE_PAM_IDLE)) {
-        cairo_scale(ctx, scaling_factor(), scaling_factor());
+        paint_image(xcb_ctx, resolution);
+    }
+
+    cairo_destroy(xcb_ctx);
+    cairo_surface_destroy(xcb_output);
+}
+
+/*
+ * Frees the background cache. It will be rendered again for the then-current
+ * resolution on the next call of draw_image(), which also repaints the whole
+ * frame.
+ *
+ */
+void free_background(void) {
+    if (bg_cache == XCB_NONE)
+        return;
+
+    xcb_free_pixmap(conn, bg_cache);
+    bg_cache = XCB_NONE;
+    screen_damaged = true;
+}
+
+/*
+ * Returns the (centered) text for the current PAM state, if any, and the font
+ * size to draw it with. buf needs to hold at least 4 bytes.
+ *
+ */
+static const char *indicator_text(char *buf, double *font_size) {
+    *font_size = 28.0;
+    switch (pam_state) {
+        case STATE_PAM_VERIFY:
+            return "verifying…";
+        case STATE_PAM_WRONG:
+            return "wrong!";
+        default:
+            if (show_failed_attempts && failed_attempts > 0) {
+                *font_size = 32.0;
+                if (failed_attempts > 999)
+                    return "> 999";
+                /* We don't want to show more than a 3-digit number. */
+                snprintf(buf, 4, "%d", failed_attempts);
+                return buf;
+            }
+            return NULL;
+    }
+}
+
+static void set_source(cairo_t *ctx, const rgba_t *color) {
+    cairo_set_source_rgba(ctx, color->red, color->green, color->blue, color->alpha);
+}
+
+/*
+ * Draws one layer of the unlock indicator onto the given context, which is
+ * already scaled. For LAYER_RING, param is the PAM state to draw the ring for,
+ * for the highlight layers it is the position (in HIGHLIGHT_STEPS) of the
+ * highlighted part. The text layer always follows the current state.
+ *
+ */
+static void draw_indicator_layer(cairo_t *ctx, indicator_layer_t layer, int param) {
+    if (layer == LAYER_RING) {
+        pam_state_t state = param;
         /* Draw a (centered) circle with transparent background. */
         cairo_set_line_width(ctx, 10.0);
         cairo_arc(ctx,
@@ -259,92 +599,36 @@ xcb_pixmap_t draw_image(uint32_t *resolution) {
 
         /* Use the appropriate color for the different PAM states
          * (currently verifying, wrong password, or default) */
-        switch (pam_state) {
-            case STATE_PAM_VERIFY:
-                cairo_set_source_rgba(ctx, (double)insidever16[0]/255, (double)insidever16[1]/255, (double)insidever16[2]/255, (double)insidever16[3]/255);
-                break;
-            case STATE_PAM_WRONG:
-                cairo_set_source_rgba(ctx, (double)insidewrong16[0]/255, (double)insidewrong16[1]/255, (double)insidewrong16[2]/255, (double)insidewrong16[3]/255);
-                break;
-            default:
-                cairo_set_source_rgba(ctx, (double)inside16[0]/255, (double)inside16[1]/255, (double)inside16[2]/255, (double)inside16[3]/255);
-                break;
-        }
+        set_source(ctx, &theme.inside[state]);
         cairo_fill_preserve(ctx);
 
-        switch (pam_state) {
-            case STATE_PAM_VERIFY:
-                cairo_set_source_rgba(ctx, (double)ringver16[0]/255, (double)ringver16[1]/255, (double)ringver16[2]/255, (double)ringver16[3]/255);
-                if (internal_line_source == 1) {
-                  line16[0] = ringver16[0];
-                  line16[1] = ringver16[1];
-                  line16[2] = ringver16[2];
-                  line16[3] = ringver16[3];
-                }
-                break;
-            case STATE_PAM_WRONG:
-                cairo_set_source_rgba(ctx, (double)ringwrong16[0]/255, (double)ringwrong16[1]/255, (double)ringwrong16[2]/255, (double)ringwrong16[3]/255);
-                if (internal_line_source == 1) {
-                  line16[0] = ringwrong16[0];
-                  line16[1] = ringwrong16[1];
-                  line16[2] = ringwrong16[2];
-                  line16[3] = ringwrong16[3];
-                }
-                break;
-            case STATE_PAM_IDLE:
-                cairo_set_source_rgba(ctx, (double)ring16[0]/255, (double)ring16[1]/255, (double)ring16[2]/255, (double)ring16[3]/255);
-                if (internal_line_source == 1) {
-                  line16[0] = ring16[0];
-                  line16[1] = ring16[1];
-                  line16[2] = ring16[2];
-                  line16[3] = ring16[3];
-                }
-                break;
-        }
+        set_source(ctx, &theme.ring[state]);
         cairo_stroke(ctx);
 
         /* Draw an inner separator line. */
-        if (internal_line_source != 2) { //pretty sure this only needs drawn if it's being drawn over the inside?
-          cairo_set_source_rgba(ctx, (double)line16[0]/255, (double)line16[1]/255, (double)line16[2]/255, (double)line16[3]/255);
-          cairo_set_line_width(ctx, 2.0);
-          cairo_arc(ctx,
-                    BUTTON_CENTER /* x */,
-                    BUTTON_CENTER /* y */,
-                    BUTTON_RADIUS - 5 /* radius */,
-                    0,
-                    2 * M_PI);
-          cairo_stroke(ctx);
+        if (theme.draw_line) {
+            set_source(ctx, &theme.line[state]);
+            cairo_set_line_width(ctx, 2.0);
+            cairo_arc(ctx,
+                      BUTTON_CENTER /* x */,
+                      BUTTON_CENTER /* y */,
+                      BUTTON_RADIUS - 5 /* radius */,
+                      0,
+                      2 * M_PI);
+            cairo_stroke(ctx);
         }
-
-        cairo_set_line_width(ctx, 10.0);
-
-        /* Display a (centered) text of the current PAM state. */
-        char *text = NULL;
-        /* We don't want to show more than a 3-digit number. */
+    } else if (layer == LAYER_TEXT) {
         char buf[4];
-
-        cairo_set_source_rgba(ctx, (double)text16[0]/255, (double)text16[1]/255, (double)text16[2]/255, (double)text16[3]/255); //this was moved up to here
-        cairo_set_font_size(ctx, 28.0);
-        switch (pam_state) {
-            case STATE_PAM_VERIFY:
-                text = "verifying…";
-                break;
-            case STATE_PAM_WRONG:
-                text = "wrong!";
-                break;
-            default:
-                if (show_failed_attempts && failed_attempts > 0) {
-                    if (failed_attempts > 999) {
-                        text = "> 999";
-                    } else {
-                        snprintf(buf, sizeof(buf), "%d", failed_attempts);
-                        text = buf;
-                    }
-                    cairo_set_source_rgba(ctx, (double)text16[0]/255, (double)text16[1]/255, (double)text16[2]/255, (double)text16[3]/255);
-                    cairo_set_font_size(ctx, 32.0);
-                }
-                break;
+        double font_size;
+        /* Display a (centered) text of the current PAM state. */
+        const char *text = indicator_text(buf, &font_size);
+        if (font_name != NULL) {
+            if (font_face == NULL)
+                font_face = cairo_toy_font_face_create(font_name, CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+            cairo_set_font_face(ctx, font_face);
         }
+        set_source(ctx, &theme.text);
+        cairo_set_font_size(ctx, font_size);
 
         if (text) {
             cairo_text_extents_t extents;
@@ -373,98 +657,771 @@ xcb_pixmap_t draw_image(uint32_t *resolution) {
             cairo_show_text(ctx, modifier_string);
             cairo_close_path(ctx);
         }
-
+    } else {
         /* After the user pressed any valid key or the backspace key, we
          * highlight a random part of the unlock indicator to confirm this
          * keypress. */
-        if (unlock_state == STATE_KEY_ACTIVE ||
-            unlock_state == STATE_BACKSPACE_ACTIVE) {
-            cairo_new_sub_path(ctx);
-            double highlight_start = (rand() % (int)(2 * M_PI * 100)) / 100.0;
-            cairo_arc(ctx,
-                      BUTTON_CENTER /* x */,
-                      BUTTON_CENTER /* y */,
-                      BUTTON_RADIUS /* radius */,
-                      highlight_start,
-                      highlight_start + (M_PI / 3.0));
-            if (unlock_state == STATE_KEY_ACTIVE) {
-                /* For normal keys, we use a lighter green. */ //lol no
-                cairo_set_source_rgba(ctx, (double)keyhl16[0]/255, (double)keyhl16[1]/255, (double)keyhl16[2]/255, (double)keyhl16[3]/255);
-            } else {
-                /* For backspace, we use red. */ //lol no
-                cairo_set_source_rgba(ctx, (double)bshl16[0]/255, (double)bshl16[1]/255, (double)bshl16[2]/255, (double)bshl16[3]/255);
-            }
-            cairo_stroke(ctx);
+        double highlight_start = param * (2 * M_PI / HIGHLIGHT_STEPS);
+        cairo_set_line_width(ctx, 10.0);
+        cairo_new_sub_path(ctx);
+        cairo_arc(ctx,
+                  BUTTON_CENTER /* x */,
+                  BUTTON_CENTER /* y */,
+                  BUTTON_RADIUS /* radius */,
+                  highlight_start,
+                  highlight_start + (M_PI / 3.0));
+        if (layer == LAYER_KEY_HIGHLIGHT) {
+            /* For normal keys, we use a lighter green. */ //lol no
+            set_source(ctx, &theme.key_highlight);
+        } else {
+            /* For backspace, we use red. */ //lol no
+            set_source(ctx, &theme.backspace_highlight);
+        }
+        cairo_stroke(ctx);
 
-            /* Draw two little separators for the highlighted part of the
-             * unlock indicator. */
-            cairo_set_source_rgba(ctx, (double)sep16[0]/255, (double)sep16[1]/255, (double)sep16[2]/255, (double)sep16[3]/255);
-            cairo_arc(ctx,
-                      BUTTON_CENTER /* x */,
-                      BUTTON_CENTER /* y */,
-                      BUTTON_RADIUS /* radius */,
-                      highlight_start /* start */,
-                      highlight_start + (M_PI / 128.0) /* end */);
-            cairo_stroke(ctx);
-            cairo_arc(ctx,
-                      BUTTON_CENTER /* x */,
-                      BUTTON_CENTER /* y */,
-                      BUTTON_RADIUS /* radius */,
-                      highlight_start + (M_PI / 3.0) /* start */,
-                      (highlight_start + (M_PI / 3.0)) + (M_PI / 128.0) /* end */);
-            cairo_stroke(ctx);
+        /* Draw two little separators for the highlighted part of the
+         * unlock indicator. */
+        set_source(ctx, &theme.separator);
+        cairo_arc(ctx,
+                  BUTTON_CENTER /* x */,
+                  BUTTON_CENTER /* y */,
+                  BUTTON_RADIUS /* radius */,
+                  highlight_start /* start */,
+                  highlight_start + (M_PI / 128.0) /* end */);
+        cairo_stroke(ctx);
+        cairo_arc(ctx,
+                  BUTTON_CENTER /* x */,
+                  BUTTON_CENTER /* y */,
+                  BUTTON_RADIUS /* radius */,
+                  highlight_start + (M_PI / 3.0) /* start */,
+                  (highlight_start + (M_PI / 3.0)) + (M_PI / 128.0) /* end */);
+        cairo_stroke(ctx);
+    }
+}
+
+/*
+ * Renders one layer of the unlock indicator for the given sprite set into a new
+ * server-side surface similar to the given one, so that it can be composited
+ * without uploading anything.
+ *
+ */
+static cairo_surface_t *render_sprite(cairo_surface_t *target, const sprite_set_t *set, indicator_layer_t layer, int param) {
+    cairo_surface_t *sprite = cairo_surface_create_similar(target, CAIRO_CONTENT_COLOR_ALPHA, set->diameter, set->diameter);
+    cairo_t *ctx = cairo_create(sprite);
+
+    cairo_scale(ctx, set->scale, set->scale);
+    draw_indicator_layer(ctx, layer, param);
+    cairo_destroy(ctx);
+
+    return sprite;
+}
+
+/*
+ * Frees the pre-rendered parts of the unlock indicator in the given set.
+ *
+ */
+static void free_sprite_set(sprite_set_t *set) {
+    for (int i = 0; i < 3; i++) {
+        if (set->ring[i] != NULL)
+            cairo_surface_destroy(set->ring[i]);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        for (int step = 0; step < HIGHLIGHT_STEPS; step++) {
+            if (set->highlight[i][step] != NULL)
+                cairo_surface_destroy(set->highlight[i][step]);
         }
     }
 
+    for (int i = 0; i < TEXT_SPRITES; i++) {
+        if (set->texts[i].surface != NULL)
+            cairo_surface_destroy(set->texts[i].surface);
+        free(set->texts[i].modifiers);
+    }
+}
+
+/*
+ * Returns the sprite set for the given scaling factor, creating it if
+ * necessary. The rings are rendered right away since every visible unlock
+ * indicator needs one, the highlights only when they are used for the first
+ * time.
+ *
+ */
+static sprite_set_t *get_sprite_set(cairo_surface_t *target, double scale) {
+    for (int n = 0; n < sprite_set_count; n++) {
+        if (sprite_sets[n].scale == scale)
+            return &sprite_sets[n];
+    }
+
+    if (sprite_set_count == sprite_set_capacity) {
+        int capacity = (sprite_set_capacity == 0 ? 2 : 2 * sprite_set_capacity);
+        if ((sprite_sets = realloc(sprite_sets, capacity * sizeof(sprite_set_t))) == NULL)
+            err(EXIT_FAILURE, "Could not allocate memory for the unlock indicator");
+        sprite_set_capacity = capacity;
+    }
+
+    sprite_set_t *set = &sprite_sets[sprite_set_count++];
+    memset(set, 0, sizeof(sprite_set_t));
+    set->scale = scale;
+    set->diameter = ceil(scale * BUTTON_DIAMETER);
+    DEBUG("rendering unlock indicator for scaling factor %.2f, physical diameter is %d px\n",
+          scale, set->diameter);
+
+    for (int i = 0; i < 3; i++)
+        set->ring[i] = render_sprite(target, set, LAYER_RING, i);
+
+    return set;
+}
+
+/*
+ * Returns the sprite holding the text for the current state, or NULL if there
+ * is no text to display. The last TEXT_SPRITES texts are kept, so a text is
+ * only laid out and rendered again when it was not shown recently (i.e., the
+ * number of failed attempts or the list of modifiers changed).
+ *
+ */
+static cairo_surface_t *get_text_sprite(cairo_surface_t *target, sprite_set_t *set) {
+    static unsigned int use_counter;
+    char buf[4];
+    double font_size;
+    const char *text = indicator_text(buf, &font_size);
+    const char *modifiers = (pam_state == STATE_PAM_WRONG ? modifier_string : NULL);
+
+    if (text == NULL && modifiers == NULL)
+        return NULL;
+
+    if (text == NULL)
+        text = "";
+
+    text_sprite_t *sprite = &set->texts[0];
+    for (int i = 0; i < TEXT_SPRITES; i++) {
+        text_sprite_t *candidate = &set->texts[i];
+        if (candidate->surface != NULL &&
+            strcmp(candidate->text, text) == 0 &&
+            ((modifiers == NULL && candidate->modifiers == NULL) ||
+             (modifiers != NULL && candidate->modifiers != NULL &&
+              strcmp(modifiers, candidate->modifiers) == 0))) {
+            candidate->last_used = ++use_counter;
+            return candidate->surface;
+        }
+        /* Otherwise, replace an unused or the least recently used one. */
+        if (sprite->surface != NULL &&
+            (candidate->surface == NULL || candidate->last_used < sprite->last_used))
+            sprite = candidate;
+    }
+
+    if (sprite->surface != NULL)
+        cairo_surface_destroy(sprite->surface);
+    free(sprite->modifiers);
+
+    sprite->surface = render_sprite(target, set, LAYER_TEXT, 0);
+    snprintf(sprite->text, sizeof(sprite->text), "%s", text);
+    sprite->modifiers = (modifiers != NULL ? strdup(modifiers) : NULL);
+    sprite->last_used = ++use_counter;
+
+    return sprite->surface;
+}
+
+/*
+ * Returns the highlight sprite of the given kind (0 for keys, 1 for backspace)
+ * at the given position.
+ *
+ */
+static cairo_surface_t *get_highlight_sprite(cairo_surface_t *target, sprite_set_t *set, int kind, int step) {
+    if (set->highlight[kind][step] == NULL)
+        set->highlight[kind][step] = render_sprite(target, set, LAYER_KEY_HIGHLIGHT + kind, step);
+    return set->highlight[kind][step];
+}
+
+/*
+ * Returns the position (in HIGHLIGHT_STEPS) of the spinner, or -1 if it is
+ * not shown.
+ *
+ */
+static int spinner_step(void) {
+    if (!anim_spinning(ANIM_SPINNER))
+        return -1;
+    return (int)(anim_value(ANIM_SPINNER) * HIGHLIGHT_STEPS) % HIGHLIGHT_STEPS;
+}
+
+/*
+ * Returns the number of unlock indicators to draw: one in the middle of each
+ * Xinerama screen, or only one if a screen was chosen with -S (or if we have
+ * no information about the screens at all).
+ *
+ */
+static int indicator_count(void) {
+    if (xr_screens > 0 && (screen_number == -1 || screen_number >= xr_screens))
+        return xr_screens;
+    return 1;
+}
+
+/*
+ * Returns the screen the given unlock indicator is displayed on, or -1 if we
+ * have no information about the screens.
+ *
+ */
+static int indicator_screen(int indicator) {
+    if (xr_screens == 0)
+        return -1;
+    if (screen_number != -1 && screen_number < xr_screens)
+        return screen_number;
+    return indicator;
+}
+
+/*
+ * Returns the scaling factor of the screen the given unlock indicator is
+ * displayed on.
+ *
+ */
+static double indicator_scale(int indicator) {
+    int monitor = indicator_screen(indicator);
+    if (monitor != -1 && xr_scales != NULL && xr_scales[monitor] > 0)
+        return xr_scales[monitor];
+    return root_scaling_factor();
+}
+
+/*
+ * Frees the sprite sets whose scaling factor no longer matches any monitor,
+ * e.g. after a monitor was unplugged. Called when the monitors changed, so
+ * that sets for old layouts do not pile up while i3lock keeps running (which,
+ * with --daemon, can be a long time). They are rendered again if needed.
+ *
+ */
+void free_unused_indicator_sprites(void) {
+    const int count = indicator_count();
+    int kept = 0;
+    for (int n = 0; n < sprite_set_count; n++) {
+        bool used = false;
+        for (int i = 0; i < count && !used; i++)
+            used = (indicator_scale(i) == sprite_sets[n].scale);
+
+        if (used) {
+            sprite_sets[kept++] = sprite_sets[n];
+        } else {
+            DEBUG("freeing unlock indicator for scaling factor %.2f\n", sprite_sets[n].scale);
+            free_sprite_set(&sprite_sets[n]);
+        }
+    }
+    sprite_set_count = kept;
+}
+
+/*
+ * Returns the area covered by the given unlock indicator.
+ *
+ */
+static xcb_rectangle_t indicator_rect(int indicator) {
+    int button_diameter_physical = ceil(indicator_scale(indicator) * BUTTON_DIAMETER);
+    xcb_rectangle_t rect = {0, 0, button_diameter_physical, button_diameter_physical};
+
     if (xr_screens > 0) {
         /* Composite the unlock indicator in the middle of each screen. */
-        // excuse me, just gonna hack something in right here
-        if (screen_number != -1 && screen_number < xr_screens) {
-          int x = (xr_resolutions[screen_number].x + ((xr_resolutions[screen_number].width / 2) - (button_diameter_physical / 2)));
-          int y = (xr_resolutions[screen_number].y + ((xr_resolutions[screen_number].height / 2) - (button_diameter_physical / 2)));
-          cairo_set_source_surface(xcb_ctx, output, x, y);
-          cairo_rectangle(xcb_ctx, x, y, button_diameter_physical, button_diameter_physical);
-          cairo_fill(xcb_ctx);        }
-        else {
-          for (int screen = 0; screen < xr_screens; screen++) {
-              int x = (xr_resolutions[screen].x + ((xr_resolutions[screen].width / 2) - (button_diameter_physical / 2)));
-              int y = (xr_resolutions[screen].y + ((xr_resolutions[screen].height / 2) - (button_diameter_physical / 2)));
-              cairo_set_source_surface(xcb_ctx, output, x, y);
-              cairo_rectangle(xcb_ctx, x, y, button_diameter_physical, button_diameter_physical);
-              cairo_fill(xcb_ctx);
-          }
-        }
+        indicator = indicator_screen(indicator);
+        rect.x = (xr_resolutions[indicator].x + ((xr_resolutions[indicator].width / 2) - (button_diameter_physical / 2)));
+        rect.y = (xr_resolutions[indicator].y + ((xr_resolutions[indicator].height / 2) - (button_diameter_physical / 2)));
     } else {
         /* We have no information about the screen sizes/positions, so we just
          * place the unlock indicator in the middle of the X root window and
          * hope for the best. */
-        int x = (last_resolution[0] / 2) - (button_diameter_physical / 2);
-        int y = (last_resolution[1] / 2) - (button_diameter_physical / 2);
-        cairo_set_source_surface(xcb_ctx, output, x, y);
-        cairo_rectangle(xcb_ctx, x, y, button_diameter_physical, button_diameter_physical);
-        cairo_fill(xcb_ctx);
+        rect.x = (last_resolution[0] / 2) - (button_diameter_physical / 2);
+        rect.y = (last_resolution[1] / 2) - (button_diameter_physical / 2);
+    }
+
+    return rect;
+}
+
+/*
+ * Computes the areas of the unlock indicators for this frame, remembering the
+ * ones of the previous frame. Then collects the areas which need to be
+ * updated in a partial frame into damaged_rects: the current ones plus the
+ * previous ones which are not covered anymore.
+ *
+ */
+static void update_indicator_rects(void) {
+    xcb_rectangle_t *swap = previous_rects;
+    previous_rects = drawn_rects;
+    previous_count = drawn_count;
+    drawn_rects = swap;
+
+    swap = previous_damaged_rects;
+    previous_damaged_rects = damaged_rects;
+    previous_damaged_count = damaged_count;
+    damaged_rects = swap;
+
+    int count = indicator_count();
+    if (count > rects_capacity) {
+        drawn_rects = realloc(drawn_rects, count * sizeof(xcb_rectangle_t));
+        previous_rects = realloc(previous_rects, count * sizeof(xcb_rectangle_t));
+        damaged_rects = realloc(damaged_rects, 2 * count * sizeof(xcb_rectangle_t));
+        previous_damaged_rects = realloc(previous_damaged_rects, 2 * count * sizeof(xcb_rectangle_t));
+        if (!drawn_rects || !previous_rects || !damaged_rects || !previous_damaged_rects)
+            err(EXIT_FAILURE, "Could not allocate memory for the unlock indicators");
+        rects_capacity = count;
+    }
+
+    for (int i = 0; i < count; i++)
+        drawn_rects[i] = indicator_rect(i);
+    drawn_count = count;
+
+    memcpy(damaged_rects, drawn_rects, drawn_count * sizeof(xcb_rectangle_t));
+    damaged_count = drawn_count;
+    for (int i = 0; i < previous_count; i++) {
+        bool moved = true;
+        for (int j = 0; j < drawn_count && moved; j++)
+            moved = (memcmp(&previous_rects[i], &drawn_rects[j], sizeof(xcb_rectangle_t)) != 0);
+        if (moved)
+            damaged_rects[damaged_count++] = previous_rects[i];
+    }
+}
+
+/*
+ * Creates the graphics context for --core-indicator and opens the core font
+ * for its text. The "fixed" font is available on every X server and
+ * monospaced, so text can be centered without asking the server for its
+ * extents.
+ *
+ */
+static void init_core_drawing(void) {
+    core_gc = xcb_generate_id(conn);
+    xcb_create_gc(conn, core_gc, bg_pixmap, XCB_GC_GRAPHICS_EXPOSURES, (uint32_t[]){0});
+
+    const char *name = "fixed";
+    xcb_font_t font = xcb_generate_id(conn);
+    xcb_void_cookie_t open_cookie = xcb_open_font_checked(conn, font, strlen(name), name);
+    xcb_query_font_reply_t *reply = ROUND_TRIP(xcb_query_font_reply(conn, xcb_query_font(conn, font), NULL));
+    xcb_generic_error_t *error = ROUND_TRIP(xcb_request_check(conn, open_cookie));
+    if (error != NULL || reply == NULL) {
+        if (debug_mode)
+            fprintf(stderr, "Could not open the core font \"%s\", not drawing text\n", name);
+        free(error);
+        free(reply);
+        return;
+    }
+
+    core_font = font;
+    core_char_width = reply->max_bounds.character_width;
+    core_font_ascent = reply->font_ascent;
+    core_font_descent = reply->font_descent;
+    free(reply);
+    xcb_change_gc(conn, core_gc, XCB_GC_FONT, (uint32_t[]){core_font});
+}
+
+/*
+ * Returns the arc of the circle with the given radius around the given center,
+ * starting at the given angle (in radians, clockwise like cairo) and spanning
+ * the given angle.
+ *
+ */
+static xcb_arc_t core_arc(double x, double y, double radius, double start, double span) {
+    return (xcb_arc_t){
+        .x = lround(x - radius),
+        .y = lround(y - radius),
+        .width = lround(2 * radius),
+        .height = lround(2 * radius),
+        /* X11 measures angles in 1/64 degrees, counter-clockwise. */
+        .angle1 = lround(-start * (180 / M_PI) * 64),
+        .angle2 = lround(-span * (180 / M_PI) * 64)};
+}
+
+static void set_core_color(const rgba_t *color, double line_width) {
+    uint32_t values[] = {rgba_pixel(color), (line_width < 1 ? 1 : lround(line_width))};
+    xcb_change_gc(conn, core_gc, XCB_GC_FOREGROUND | XCB_GC_LINE_WIDTH, values);
+}
+
+/*
+ * Draws the given text centered around the given point with the core font.
+ * The core font only covers ASCII, so "…" is replaced with "..." and other
+ * characters are left out.
+ *
+ */
+static void draw_core_text(const char *text, double x, double y) {
+    /* A PolyText8 item is a length byte, a delta byte and up to 254 bytes. */
+    uint8_t item[2 + 254];
+    int length = 0;
+    const size_t ellipsis_length = strlen("…");
+
+    for (const char *c = text; *c != '\0' && length < 254 - 2; c++) {
+        if (strncmp(c, "…", ellipsis_length) == 0) {
+            memcpy(&item[2 + length], "...", 3);
+            length += 3;
+            c += ellipsis_length - 1;
+        } else if ((unsigned char)*c < 0x80) {
+            item[2 + length++] = *c;
+        }
+    }
+    item[0] = length;
+    item[1] = 0;
+
+    xcb_poly_text_8(conn, bg_pixmap, core_gc,
+                    lround(x - length * core_char_width / 2.0),
+                    lround(y + (core_font_ascent - core_font_descent) / 2.0),
+                    2 + length, item);
+}
+
+/*
+ * Draws the highlighted part of the ring at the given position (in
+ * HIGHLIGHT_STEPS) with core X11 requests.
+ *
+ */
+static void draw_core_highlight(double x, double y, double radius, double scale, const rgba_t *color, int step) {
+    double highlight_start = step * (2 * M_PI / HIGHLIGHT_STEPS);
+    xcb_arc_t highlight = core_arc(x, y, radius, highlight_start, M_PI / 3.0);
+    set_core_color(color, 10.0 * scale);
+    xcb_poly_arc(conn, bg_pixmap, core_gc, 1, &highlight);
+
+    xcb_arc_t separators[] = {
+        core_arc(x, y, radius, highlight_start, M_PI / 128.0),
+        core_arc(x, y, radius, highlight_start + (M_PI / 3.0), M_PI / 128.0)};
+    set_core_color(&theme.separator, 10.0 * scale);
+    xcb_poly_arc(conn, bg_pixmap, core_gc, 2, separators);
+}
+
+/*
+ * Draws the unlock indicator in the given area with core X11 requests
+ * (PolyFillArc, PolyArc and PolyText8) instead of compositing sprites. This
+ * needs neither the RENDER extension nor any client-side rendering, and a
+ * frame is only a few hundred bytes of requests, which matters on remote X
+ * servers. The price is that colors are drawn without their alpha channel
+ * (fully transparent parts are left out) and the text uses a core font.
+ *
+ */
+static void draw_indicator_core(xcb_rectangle_t rect, double scale) {
+    const double x = rect.x + BUTTON_CENTER * scale;
+    const double y = rect.y + BUTTON_CENTER * scale;
+    const double radius = BUTTON_RADIUS * scale;
+
+    if (core_gc == XCB_NONE)
+        init_core_drawing();
+
+    /* Text which does not fit would otherwise be left behind by later partial
+     * redraws, which only restore the area of the indicator. */
+    xcb_set_clip_rectangles(conn, XCB_CLIP_ORDERING_UNSORTED, core_gc, 0, 0, 1, &rect);
+
+    xcb_arc_t circle = core_arc(x, y, radius, 0, 2 * M_PI);
+    if (theme.inside[pam_state].alpha > 0) {
+        set_core_color(&theme.inside[pam_state], 0);
+        xcb_poly_fill_arc(conn, bg_pixmap, core_gc, 1, &circle);
+    }
+    if (theme.ring[pam_state].alpha > 0) {
+        set_core_color(&theme.ring[pam_state], 10.0 * scale);
+        xcb_poly_arc(conn, bg_pixmap, core_gc, 1, &circle);
+    }
+    if (theme.draw_line && theme.line[pam_state].alpha > 0) {
+        xcb_arc_t line = core_arc(x, y, radius - 5 * scale, 0, 2 * M_PI);
+        set_core_color(&theme.line[pam_state], 2.0 * scale);
+        xcb_poly_arc(conn, bg_pixmap, core_gc, 1, &line);
+    }
+
+    if (spinner_step() >= 0)
+        draw_core_highlight(x, y, radius, scale, &theme.key_highlight, spinner_step());
+    if (unlock_state == STATE_KEY_ACTIVE ||
+        unlock_state == STATE_BACKSPACE_ACTIVE)
+        draw_core_highlight(x, y, radius, scale,
+                            unlock_state == STATE_KEY_ACTIVE ? &theme.key_highlight : &theme.backspace_highlight,
+                            highlight_step);
+
+    if (core_font == XCB_NONE)
+        return;
+
+    char buf[4];
+    double font_size;
+    const char *text = indicator_text(buf, &font_size);
+    set_core_color(&theme.text, 0);
+    if (text)
+        draw_core_text(text, x, y);
+    if (pam_state == STATE_PAM_WRONG && modifier_string != NULL)
+        draw_core_text(modifier_string, x, y + 28.0 * scale);
+}
+
+/*
+ * Updates the frame pixmap: restores the background, either everywhere or only
+ * in the damaged areas, and composites the unlock indicators on top.
+ *
+ */
+static void draw_frame(uint32_t *resolution, bool full) {
+    update_indicator_rects();
+
+    if (full) {
+        xcb_copy_area(conn, bg_cache, bg_pixmap, bg_gc, 0, 0, 0, 0, resolution[0], resolution[1]);
+    } else {
+        for (int i = 0; i < damaged_count; i++) {
+            xcb_rectangle_t rect = damaged_rects[i];
+            xcb_copy_area(conn, bg_cache, bg_pixmap, bg_gc, rect.x, rect.y, rect.x, rect.y, rect.width, rect.height);
+        }
+        /* The back buffer still contains the frame before the previous one. */
+        if (present_active()) {
+            for (int i = 0; i < previous_damaged_count; i++) {
+                xcb_rectangle_t rect = previous_damaged_rects[i];
+                xcb_copy_area(conn, bg_cache, bg_pixmap, bg_gc, rect.x, rect.y, rect.x, rect.y, rect.width, rect.height);
+            }
+        }
+    }
+
+    /* Hidden, or faded out completely. Core drawing cannot fade, so it
+     * shows the indicator for the whole fade. */
+    double alpha = anim_value(ANIM_OPACITY);
+    if (!unlock_indicator || alpha <= 0)
+        return;
+
+    if (core_indicator) {
+        for (int i = 0; i < drawn_count; i++)
+            draw_indicator_core(drawn_rects[i], indicator_scale(i));
+        return;
+    }
+
+    cairo_surface_t *xcb_output = cairo_xcb_surface_create(conn, bg_pixmap, vistype, resolution[0], resolution[1]);
+    cairo_t *xcb_ctx = cairo_create(xcb_output);
+
+    /* The unlock indicator is composited from pre-rendered sprites: the ring
+     * for the PAM state, the text (if any) and the highlight (if any), each
+     * rendered for the scaling factor of its monitor. */
+    for (int i = 0; i < drawn_count; i++) {
+        xcb_rectangle_t rect = drawn_rects[i];
+        sprite_set_t *set = get_sprite_set(xcb_output, indicator_scale(i));
+
+        cairo_surface_t *layers[4];
+        int num_layers = 0;
+        layers[num_layers++] = set->ring[pam_state];
+        if ((layers[num_layers] = get_text_sprite(xcb_output, set)) != NULL)
+            num_layers++;
+        if (spinner_step() >= 0)
+            layers[num_layers++] = get_highlight_sprite(xcb_output, set, 0, spinner_step());
+        if (unlock_state == STATE_KEY_ACTIVE ||
+            unlock_state == STATE_BACKSPACE_ACTIVE)
+            layers[num_layers++] = get_highlight_sprite(xcb_output, set, (unlock_state == STATE_KEY_ACTIVE ? 0 : 1), highlight_step);
+
+        for (int layer = 0; layer < num_layers; layer++) {
+            cairo_set_source_surface(xcb_ctx, layers[layer], rect.x, rect.y);
+            cairo_rectangle(xcb_ctx, rect.x, rect.y, rect.width, rect.height);
+            if (alpha < 1) {
+                /* While fading, every layer is blended on its own instead of
+                 * rendering the indicator into a group first. Where layers
+                 * overlap this differs a bit, which does not show in a short
+                 * fade. */
+                cairo_save(xcb_ctx);
+                cairo_clip(xcb_ctx);
+                cairo_paint_with_alpha(xcb_ctx, alpha);
+                cairo_restore(xcb_ctx);
+            } else {
+                cairo_fill(xcb_ctx);
+            }
+        }
     }
 
-    cairo_surface_destroy(xcb_output);
-    cairo_surface_destroy(output);
-    cairo_destroy(ctx);
     cairo_destroy(xcb_ctx);
+    cairo_surface_destroy(xcb_output);
+}
+
+/*
+ * Makes buffers[back] the frame pixmap, (re)creating it if it does not exist
+ * yet or has another resolution. The buffers are only freed when the
+ * resolution changes.
+ *
+ */
+static void select_back_buffer(uint32_t *resolution) {
+    if (bg_pixmap_resolution[0] != resolution[0] ||
+        bg_pixmap_resolution[1] != resolution[1]) {
+        for (int i = 0; i < 2; i++) {
+            if (buffers[i].pixmap == XCB_NONE)
+                continue;
+            present_forget_pixmap(buffers[i].pixmap);
+            xcb_free_pixmap(conn, buffers[i].pixmap);
+            buffers[i].pixmap = XCB_NONE;
+            buffers[i].valid = false;
+        }
+        bg_pixmap_resolution[0] = resolution[0];
+        bg_pixmap_resolution[1] = resolution[1];
+    }
+    if (buffers[back].pixmap == XCB_NONE) {
+        buffers[back].pixmap = xcb_generate_id(conn);
+        xcb_create_pixmap(conn, screen->root_depth, buffers[back].pixmap, screen->root,
+                          resolution[0], resolution[1]);
+    }
+    bg_pixmap = buffers[back].pixmap;
+}
+
+/*
+ * Draws global image with fill color onto the frame pixmap with the given
+ * resolution and returns it. The pixmap stays owned by this file: it is kept
+ * around for the following (partial) redraws.
+ *
+ */
+xcb_pixmap_t draw_image(uint32_t *resolution) {
+    if (!vistype)
+        vistype = get_root_visual_type(screen);
+
+    if (bg_cache != XCB_NONE &&
+        (bg_cache_resolution[0] != resolution[0] ||
+         bg_cache_resolution[1] != resolution[1]))
+        free_background();
+    if (bg_gc == XCB_NONE) {
+        bg_gc = xcb_generate_id(conn);
+        xcb_create_gc(conn, bg_gc, screen->root, XCB_GC_GRAPHICS_EXPOSURES, (uint32_t[]){0});
+    }
+
+    if (bg_cache == XCB_NONE) {
+        render_background(resolution);
+        image_uploaded();
+    }
+
+    select_back_buffer(resolution);
+    draw_frame(resolution, true);
+    /* Unless the whole frame changed, the other buffer differs from this one
+     * only in the areas of the unlock indicators. */
+    if (screen_damaged)
+        buffers[!back].valid = false;
+    buffers[back].valid = true;
+    screen_damaged = false;
+
     return bg_pixmap;
 }
 
 /*
- * Calls draw_image on a new pixmap and swaps that with the current pixmap
+ * Called once the window was created with the pixmap returned by
+ * draw_image(). With Present, that back buffer is drawn into by the next
+ * frame, so the window background becomes the background cache instead, like
+ * for every full frame in redraw_screen().
+ *
+ */
+void init_window_background(void) {
+    if (present_active())
+        xcb_change_window_attributes(conn, win, XCB_CW_BACK_PIXMAP, (uint32_t[1]){bg_cache});
+}
+
+/*
+ * Marks the whole screen as damaged, so that the next redraw_screen() repaints
+ * all of it instead of only the unlock indicators. Moving indicators don’t
+ * need this, their previous areas are restored automatically.
+ *
+ */
+void damage_screen(void) {
+    screen_damaged = true;
+}
+
+/*
+ * Starts fading the unlock indicator when it is shown or hidden, and the
+ * spinner while the password is being verified.
+ *
+ */
+static void update_animations(void) {
+    bool shown = (unlock_indicator &&
+                  (unlock_state >= STATE_KEY_PRESSED || pam_state != STATE_PAM_IDLE));
+    if (shown != indicator_shown) {
+        indicator_shown = shown;
+        anim_start(ANIM_OPACITY, (shown ? 1 : 0), FADE_DURATION);
+    }
+
+    if (pam_state == STATE_PAM_VERIFY)
+        anim_spin(ANIM_SPINNER, SPINNER_PERIOD, HIGHLIGHT_STEPS);
+    else
+        anim_stop(ANIM_SPINNER);
+}
+
+/*
+ * Updates the frame pixmap and exposes the damaged parts of the window. Unless
+ * the whole screen was damaged, only the areas of the unlock indicators are
+ * redrawn, so the cost of a redraw does not depend on the screen size.
+ *
+ * While the monitors are blanked, nothing is rendered at all.
+ *
+ * With the Present extension, the frame is drawn into the back buffer and
+ * shown at the next vertical blank. Until the X server confirmed the previous
+ * frame, the redraw is postponed (see present_handle_event()), so that there
+ * is at most one frame per vertical blank.
  *
  */
 void redraw_screen(void) {
     DEBUG("redraw_screen(unlock_state = %d, pam_state = %d)\n", unlock_state, pam_state);
-    xcb_pixmap_t bg_pixmap = draw_image(last_resolution);
-    xcb_change_window_attributes(conn, win, XCB_CW_BACK_PIXMAP, (uint32_t[1]){bg_pixmap});
-    /* XXX: Possible optimization: Only update the area in the middle of the
-     * screen instead of the whole screen. */
-    xcb_clear_area(conn, 0, win, 0, 0, last_resolution[0], last_resolution[1]);
-    xcb_free_pixmap(conn, bg_pixmap);
+    /* Nobody would see the frame. It is rendered (once, with the then-current
+     * state) when the monitors are back on. */
+    if (power_blanked()) {
+        redraw_scheduled = true;
+        return;
+    }
+    update_animations();
+    bool present = present_active();
+    if (present &&
+        (present_busy() ||
+         (buffers[back].pixmap != XCB_NONE && !present_pixmap_idle(buffers[back].pixmap)))) {
+        redraw_scheduled = true;
+        return;
+    }
+
+    redraw_scheduled = false;
+    double start = stats_now();
+    bool full = (screen_damaged ||
+                 buffers[back].pixmap == XCB_NONE ||
+                 !buffers[back].valid ||
+                 bg_pixmap_resolution[0] != last_resolution[0] ||
+                 bg_pixmap_resolution[1] != last_resolution[1]);
+
+    if (full) {
+        draw_image(last_resolution);
+    } else {
+        bg_pixmap = buffers[back].pixmap;
+        draw_frame(last_resolution, false);
+    }
+
+    if (present) {
+        /* The window background is only used to repaint exposed parts of the
+         * window. Since the back buffers are drawn into while exposures might
+         * still use them, it is the background cache (without the unlock
+         * indicator) instead, which only changes with full frames. */
+        if (full) {
+            xcb_change_window_attributes(conn, win, XCB_CW_BACK_PIXMAP, (uint32_t[1]){bg_cache});
+            present_frame(bg_pixmap, NULL, 0);
+        } else {
+            present_frame(bg_pixmap, damaged_rects, damaged_count);
+        }
+        back = !back;
+    } else {
+        /* Set the pixmap again, since we drew into it after it was made the
+         * window background. */
+        xcb_change_window_attributes(conn, win, XCB_CW_BACK_PIXMAP, (uint32_t[1]){bg_pixmap});
+        if (full) {
+            xcb_clear_area(conn, 0, win, 0, 0, last_resolution[0], last_resolution[1]);
+        } else {
+            for (int i = 0; i < damaged_count; i++) {
+                xcb_rectangle_t rect = damaged_rects[i];
+                xcb_clear_area(conn, 0, win, rect.x, rect.y, rect.width, rect.height);
+            }
+        }
+    }
+    stats_record_since(STAT_RENDER, start);
+    if (!full)
+        anim_frame_rendered(stats_now() - start);
     xcb_flush(conn);
+    stats_frame_flushed();
+}
+
+/*
+ * Marks the screen as outdated. Instead of rendering a frame for every state
+ * change, the frame is rendered once by process_scheduled_redraw() before the
+ * main loop blocks again.
+ *
+ */
+void schedule_redraw(void) {
+    redraw_scheduled = true;
+}
+
+/*
+ * Renders a frame if a redraw was scheduled since the last one.
+ *
+ */
+void process_scheduled_redraw(void) {
+    if (redraw_scheduled)
+        redraw_screen();
+}
+
+/*
+ * Highlights a new (random) part of the unlock indicator to confirm a key
+ * press (STATE_KEY_ACTIVE) or backspace (STATE_BACKSPACE_ACTIVE).
+ *
+ */
+void highlight_indicator(unlock_state_t state) {
+    unlock_state = state;
+    highlight_step = rand() % HIGHLIGHT_STEPS;
+    schedule_redraw();
 }
 
 /*
@@ -477,5 +1434,5 @@ void clear_indicator(void) {
         unlock_state = STATE_STARTED;
     } else
         unlock_state = STATE_KEY_PRESSED;
-    redraw_screen();
+    schedule_redraw();
 }
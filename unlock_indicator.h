@@ -16,8 +16,24 @@ typedef enum {
     STATE_PAM_WRONG = 2   /* the password was wrong */
 } pam_state_t;
 
+typedef enum {
+    IMAGE_MODE_NONE = 0, /* paint the image once at the origin of the root
+                            window (or tiled, see -t) */
+    IMAGE_MODE_FILL,     /* scale to cover each monitor, cropping the excess */
+    IMAGE_MODE_FIT,      /* scale to fit into each monitor, keeping borders */
+    IMAGE_MODE_CENTER,   /* center on each monitor without scaling */
+    IMAGE_MODE_STRETCH   /* scale to each monitor, ignoring the aspect ratio */
+} image_mode_t;
+
+void free_background(void);
+void free_unused_indicator_sprites(void);
 xcb_pixmap_t draw_image(uint32_t* resolution);
+void init_window_background(void);
+void damage_screen(void);
 void redraw_screen(void);
+void schedule_redraw(void);
+void process_scheduled_redraw(void);
+void highlight_indicator(unlock_state_t state);
 void clear_indicator(void);
 
 #endif
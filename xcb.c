@@ -10,19 +10,37 @@
 #include <xcb/xcb.h>
 #include <xcb/xcb_image.h>
 #include <xcb/xcb_atom.h>
+#include <xcb/shm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <assert.h>
 #include <err.h>
 
+#include "i3lock.h"
 #include "cursors.h"
+#include "xcb.h"
+#include "stats.h"
 
 xcb_connection_t *conn;
 xcb_screen_t *screen;
 
+/* Defined in i3lock.c, needed for DEBUG(). */
+extern bool debug_mode;
+
+/* Retry grabbing pointer and keyboard for this long before giving up, see
+ * grab_pointer_and_keyboard(). */
+#define GRAB_TIMEOUT_MS 2000
+/* The delay between retries starts at GRAB_MIN_DELAY_US and is doubled after
+ * every failed try, up to GRAB_MAX_DELAY_US. */
+#define GRAB_MIN_DELAY_US 500
+#define GRAB_MAX_DELAY_US 64000
+
 #define curs_invisible_width 8
 #define curs_invisible_height 8
 
@@ -47,17 +65,6 @@ static unsigned char mask_windows_bits[] = {
     0xf7, 0x00, 0xf3, 0x00, 0xe1, 0x01, 0xe0, 0x01, 0xc0, 0x03, 0xc0, 0x03,
     0x80, 0x01};
 
-static uint32_t get_colorpixel(char *hex) {
-    char strgroups[3][3] = {{hex[0], hex[1], '\0'},
-                            {hex[2], hex[3], '\0'},
-                            {hex[4], hex[5], '\0'}};
-    uint32_t rgb16[3] = {(strtol(strgroups[0], NULL, 16)),
-                         (strtol(strgroups[1], NULL, 16)),
-                         (strtol(strgroups[2], NULL, 16))};
-
-    return (rgb16[0] << 16) + (rgb16[1] << 8) + rgb16[2];
-}
-
 xcb_visualtype_t *get_root_visual_type(xcb_screen_t *screen) {
     xcb_visualtype_t *visual_type = NULL;
     xcb_depth_iterator_t depth_iter;
@@ -80,7 +87,7 @@ xcb_visualtype_t *get_root_visual_type(xcb_screen_t *screen) {
     return NULL;
 }
 
-xcb_pixmap_t create_bg_pixmap(xcb_connection_t *conn, xcb_screen_t *scr, u_int32_t *resolution, char *color) {
+xcb_pixmap_t create_bg_pixmap(xcb_connection_t *conn, xcb_screen_t *scr, u_int32_t *resolution, uint32_t color) {
     xcb_pixmap_t bg_pixmap = xcb_generate_id(conn);
     xcb_create_pixmap(conn, scr->root_depth, bg_pixmap, scr->root,
                       resolution[0], resolution[1]);
@@ -88,7 +95,7 @@ xcb_pixmap_t create_bg_pixmap(xcb_connection_t *conn, xcb_screen_t *scr, u_int32
     /* Generate a Graphics Context and fill the pixmap with background color
      * (for images that are smaller than your screen) */
     xcb_gcontext_t gc = xcb_generate_id(conn);
-    uint32_t values[] = {get_colorpixel(color)};
+    uint32_t values[] = {color};
     xcb_create_gc(conn, gc, bg_pixmap, XCB_GC_FOREGROUND, values);
     xcb_rectangle_t rect = {0, 0, resolution[0], resolution[1]};
     xcb_poly_fill_rectangle(conn, bg_pixmap, gc, 1, &rect);
@@ -97,14 +104,174 @@ xcb_pixmap_t create_bg_pixmap(xcb_connection_t *conn, xcb_screen_t *scr, u_int32
     return bg_pixmap;
 }
 
-xcb_window_t open_fullscreen_window(xcb_connection_t *conn, xcb_screen_t *scr, char *color, xcb_pixmap_t pixmap) {
+/*
+ * Checks whether images in the layout of a cairo RGB24 surface (32 bits per
+ * pixel, 0x00RRGGBB in host byte order) can be put onto pixmaps of the root
+ * depth as they are.
+ *
+ */
+static bool root_format_matches_rgb24(xcb_connection_t *conn, xcb_screen_t *scr) {
+    const xcb_setup_t *setup = xcb_get_setup(conn);
+    const uint32_t probe = 1;
+    const uint8_t host_order = (*(const uint8_t *)&probe == 1 ? XCB_IMAGE_ORDER_LSB_FIRST : XCB_IMAGE_ORDER_MSB_FIRST);
+    xcb_visualtype_t *visual = get_root_visual_type(scr);
+
+    if (scr->root_depth != 24 || setup->image_byte_order != host_order)
+        return false;
+    if (visual == NULL ||
+        visual->red_mask != 0xff0000 ||
+        visual->green_mask != 0x00ff00 ||
+        visual->blue_mask != 0x0000ff)
+        return false;
+
+    xcb_format_iterator_t iter;
+    for (iter = xcb_setup_pixmap_formats_iterator(setup); iter.rem; xcb_format_next(&iter)) {
+        if (iter.data->depth == 24)
+            return (iter.data->bits_per_pixel == 32 && iter.data->scanline_pad == 32);
+    }
+    return false;
+}
+
+/*
+ * Creates a shared memory segment for an image of the given size and attaches
+ * it to the X server, so that the image can be put onto a pixmap without
+ * sending it over the socket. The image uses the layout of a cairo RGB24
+ * surface. The X server can only write into it (e.g. with ShmGetImage) if
+ * writable is true.
+ *
+ * Returns false if the MIT-SHM extension is not available, the X server is not
+ * running on this machine or the root window uses a different pixel format.
+ * The caller then has to fall back to uploading the image over the socket.
+ *
+ */
+bool create_shm_image(xcb_connection_t *conn, xcb_screen_t *scr, uint32_t width, uint32_t height, bool writable, shm_image_t *image) {
+    /* Once attaching failed (e.g. on remote connections), don’t try again. */
+    static bool shm_unusable = false;
+
+    if (shm_unusable)
+        return false;
+
+    const xcb_query_extension_reply_t *extension = xcb_get_extension_data(conn, &xcb_shm_id);
+    if (!extension || !extension->present || !root_format_matches_rgb24(conn, scr)) {
+        DEBUG("MIT-SHM not usable, uploading images over the socket\n");
+        shm_unusable = true;
+        return false;
+    }
+
+    image->width = width;
+    image->height = height;
+    image->stride = width * 4;
+    image->shmid = shmget(IPC_PRIVATE, (size_t)image->stride * height, IPC_CREAT | 0600);
+    if (image->shmid == -1) {
+        DEBUG("shmget() failed, uploading images over the socket\n");
+        return false;
+    }
+
+    image->data = shmat(image->shmid, NULL, 0);
+    /* The segment is destroyed once both we and the X server detached it. */
+    shmctl(image->shmid, IPC_RMID, NULL);
+    if (image->data == (void *)-1) {
+        DEBUG("shmat() failed, uploading images over the socket\n");
+        return false;
+    }
+
+    image->seg = xcb_generate_id(conn);
+    xcb_generic_error_t *error = ROUND_TRIP(xcb_request_check(conn, xcb_shm_attach_checked(conn, image->seg, image->shmid, !writable)));
+    if (error != NULL) {
+        DEBUG("Could not attach the shared memory segment (error %d), uploading images over the socket\n",
+              error->error_code);
+        free(error);
+        shmdt(image->data);
+        shm_unusable = true;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Copies the whole shared memory image onto the given drawable. This happens
+ * entirely in the X server.
+ *
+ */
+void put_shm_image(xcb_connection_t *conn, xcb_drawable_t drawable, xcb_gcontext_t gc, shm_image_t *image) {
+    xcb_shm_put_image(conn, drawable, gc,
+                      image->width, image->height,
+                      0, 0, image->width, image->height,
+                      0, 0,
+                      24, XCB_IMAGE_FORMAT_Z_PIXMAP,
+                      false, image->seg, 0);
+}
+
+/*
+ * Detaches the shared memory image. This does not need to wait for the X
+ * server: it processes the detach after all previous requests on the segment,
+ * and its own mapping stays valid until then, no matter whether we still have
+ * ours.
+ *
+ */
+void free_shm_image(xcb_connection_t *conn, shm_image_t *image) {
+    xcb_shm_detach(conn, image->seg);
+    shmdt(image->data);
+}
+
+/*
+ * Copies the current contents of the root window into data, which needs to
+ * hold scr->height_in_pixels rows of stride bytes each, in the layout of a
+ * cairo RGB24 surface. Uses MIT-SHM when possible.
+ *
+ * Returns false if the root window uses a different pixel format or its
+ * contents could not be read.
+ *
+ */
+bool get_root_image(xcb_connection_t *conn, xcb_screen_t *scr, uint8_t *data, uint32_t stride) {
+    const uint32_t width = scr->width_in_pixels;
+    const uint32_t height = scr->height_in_pixels;
+
+    if (!root_format_matches_rgb24(conn, scr))
+        return false;
+
+    shm_image_t shm;
+    if (create_shm_image(conn, scr, width, height, true, &shm)) {
+        xcb_shm_get_image_cookie_t cookie = xcb_shm_get_image(
+            conn, scr->root, 0, 0, width, height, ~0,
+            XCB_IMAGE_FORMAT_Z_PIXMAP, shm.seg, 0);
+        xcb_shm_get_image_reply_t *reply = ROUND_TRIP(xcb_shm_get_image_reply(conn, cookie, NULL));
+        if (reply) {
+            for (uint32_t y = 0; y < height; y++)
+                memcpy(data + y * stride, shm.data + y * shm.stride, width * 4);
+        }
+        free(reply);
+        free_shm_image(conn, &shm);
+        if (reply)
+            return true;
+    }
+
+    xcb_get_image_cookie_t cookie = xcb_get_image(
+        conn, XCB_IMAGE_FORMAT_Z_PIXMAP, scr->root, 0, 0, width, height, ~0);
+    xcb_get_image_reply_t *reply = ROUND_TRIP(xcb_get_image_reply(conn, cookie, NULL));
+    if (!reply)
+        return false;
+    if (xcb_get_image_data_length(reply) < (int)(width * height * 4)) {
+        free(reply);
+        return false;
+    }
+
+    uint8_t *pixels = xcb_get_image_data(reply);
+    for (uint32_t y = 0; y < height; y++)
+        memcpy(data + y * stride, pixels + y * width * 4, width * 4);
+    free(reply);
+    return true;
+}
+
+xcb_window_t open_fullscreen_window(xcb_connection_t *conn, xcb_screen_t *scr, uint32_t color, xcb_pixmap_t pixmap) {
     uint32_t mask = 0;
     uint32_t values[3];
     xcb_window_t win = xcb_generate_id(conn);
 
     if (pixmap == XCB_NONE) {
         mask |= XCB_CW_BACK_PIXEL;
-        values[0] = get_colorpixel(color);
+        values[0] = color;
     } else {
         mask |= XCB_CW_BACK_PIXMAP;
         values[0] = pixmap;
@@ -143,72 +310,108 @@ xcb_window_t open_fullscreen_window(xcb_connection_t *conn, xcb_screen_t *scr, c
                         strlen(name),
                         name);
 
+    return win;
+}
+
+/*
+ * Maps the window created by open_fullscreen_window() and puts it on top.
+ *
+ */
+void map_fullscreen_window(xcb_connection_t *conn, xcb_window_t win) {
     /* Map the window (= make it visible) */
     xcb_map_window(conn, win);
 
     /* Raise window (put it on top) */
-    values[0] = XCB_STACK_MODE_ABOVE;
+    uint32_t values[] = {XCB_STACK_MODE_ABOVE};
     xcb_configure_window(conn, win, XCB_CONFIG_WINDOW_STACK_MODE, values);
-
-    return win;
 }
 
 /*
- * Repeatedly tries to grab pointer and keyboard (up to 1000 times).
+ * Grabs pointer and keyboard. Both grab requests are sent at once, and as long
+ * as another client (e.g. an open menu) holds a grab, we retry with an
+ * exponentially increasing delay until GRAB_TIMEOUT_MS have passed.
+ *
+ * Returns false (after releasing a partial grab) if that did not succeed.
  *
  */
-void grab_pointer_and_keyboard(xcb_connection_t *conn, xcb_screen_t *screen, xcb_cursor_t cursor) {
+bool grab_pointer_and_keyboard(xcb_connection_t *conn, xcb_screen_t *screen, xcb_cursor_t cursor) {
     xcb_grab_pointer_cookie_t pcookie;
     xcb_grab_pointer_reply_t *preply;
 
     xcb_grab_keyboard_cookie_t kcookie;
     xcb_grab_keyboard_reply_t *kreply;
 
-    int tries = 10000;
-
-    while (tries-- > 0) {
-        pcookie = xcb_grab_pointer(
-            conn,
-            false,               /* get all pointer events specified by the following mask */
-            screen->root,        /* grab the root window */
-            XCB_NONE,            /* which events to let through */
-            XCB_GRAB_MODE_ASYNC, /* pointer events should continue as normal */
-            XCB_GRAB_MODE_ASYNC, /* keyboard mode */
-            XCB_NONE,            /* confine_to = in which window should the cursor stay */
-            cursor,              /* we change the cursor to whatever the user wanted */
-            XCB_CURRENT_TIME);
-
-        if ((preply = xcb_grab_pointer_reply(conn, pcookie, NULL)) &&
-            preply->status == XCB_GRAB_STATUS_SUCCESS) {
+    bool pointer_grabbed = false;
+    bool keyboard_grabbed = false;
+    useconds_t delay = GRAB_MIN_DELAY_US;
+    int tries = 0;
+    struct timespec start, now;
+    double elapsed;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (true) {
+        tries++;
+
+        const bool pointer_requested = !pointer_grabbed;
+        if (pointer_requested)
+            pcookie = xcb_grab_pointer(
+                conn,
+                false,               /* get all pointer events specified by the following mask */
+                screen->root,        /* grab the root window */
+                XCB_NONE,            /* which events to let through */
+                XCB_GRAB_MODE_ASYNC, /* pointer events should continue as normal */
+                XCB_GRAB_MODE_ASYNC, /* keyboard mode */
+                XCB_NONE,            /* confine_to = in which window should the cursor stay */
+                cursor,              /* we change the cursor to whatever the user wanted */
+                XCB_CURRENT_TIME);
+
+        if (!keyboard_grabbed)
+            kcookie = xcb_grab_keyboard(
+                conn,
+                true,         /* report events */
+                screen->root, /* grab the root window */
+                XCB_CURRENT_TIME,
+                XCB_GRAB_MODE_ASYNC, /* process events as normal, do not require sync */
+                XCB_GRAB_MODE_ASYNC);
+
+        if (pointer_requested) {
+            preply = ROUND_TRIP(xcb_grab_pointer_reply(conn, pcookie, NULL));
+            pointer_grabbed = (preply && preply->status == XCB_GRAB_STATUS_SUCCESS);
             free(preply);
-            break;
         }
 
-        /* Make this quite a bit slower */
-        usleep(50);
-    }
-
-    while (tries-- > 0) {
-        kcookie = xcb_grab_keyboard(
-            conn,
-            true,         /* report events */
-            screen->root, /* grab the root window */
-            XCB_CURRENT_TIME,
-            XCB_GRAB_MODE_ASYNC, /* process events as normal, do not require sync */
-            XCB_GRAB_MODE_ASYNC);
-
-        if ((kreply = xcb_grab_keyboard_reply(conn, kcookie, NULL)) &&
-            kreply->status == XCB_GRAB_STATUS_SUCCESS) {
+        if (!keyboard_grabbed) {
+            /* If the pointer grab was sent as well, this reply arrived with the
+             * same round trip. */
+            kreply = ROUND_TRIP_IF(!pointer_requested, xcb_grab_keyboard_reply(conn, kcookie, NULL));
+            keyboard_grabbed = (kreply && kreply->status == XCB_GRAB_STATUS_SUCCESS);
             free(kreply);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = (now.tv_sec - start.tv_sec) * 1000.0 +
+                  (now.tv_nsec - start.tv_nsec) / 1000000.0;
+
+        if (pointer_grabbed && keyboard_grabbed)
             break;
+
+        if (elapsed >= GRAB_TIMEOUT_MS) {
+            warnx("Cannot grab %s", (pointer_grabbed ? "keyboard" : (keyboard_grabbed ? "pointer" : "pointer/keyboard")));
+            if (pointer_grabbed)
+                xcb_ungrab_pointer(conn, XCB_CURRENT_TIME);
+            if (keyboard_grabbed)
+                xcb_ungrab_keyboard(conn, XCB_CURRENT_TIME);
+            return false;
         }
 
-        /* Make this quite a bit slower */
-        usleep(50);
+        usleep(delay);
+        if (delay < GRAB_MAX_DELAY_US)
+            delay *= 2;
     }
 
-    if (tries <= 0)
-        errx(EXIT_FAILURE, "Cannot grab pointer/keyboard");
+    DEBUG("grabbed pointer and keyboard after %d tries (%.3f ms)\n", tries, elapsed);
+    return true;
 }
 
 xcb_cursor_t create_cursor(xcb_connection_t *conn, xcb_screen_t *screen, xcb_window_t win, int choice) {
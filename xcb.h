@@ -3,14 +3,31 @@
 
 #include <xcb/xcb.h>
 #include <xcb/dpms.h>
+#include <xcb/shm.h>
+#include <stdbool.h>
+
+/* An image in a shared memory segment, see create_shm_image(). */
+typedef struct shm_image {
+    xcb_shm_seg_t seg;
+    int shmid;
+    uint8_t *data;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+} shm_image_t;
 
 extern xcb_connection_t *conn;
 extern xcb_screen_t *screen;
 
 xcb_visualtype_t *get_root_visual_type(xcb_screen_t *s);
-xcb_pixmap_t create_bg_pixmap(xcb_connection_t *conn, xcb_screen_t *scr, u_int32_t *resolution, char *color);
-xcb_window_t open_fullscreen_window(xcb_connection_t *conn, xcb_screen_t *scr, char *color, xcb_pixmap_t pixmap);
-void grab_pointer_and_keyboard(xcb_connection_t *conn, xcb_screen_t *screen, xcb_cursor_t cursor);
+xcb_pixmap_t create_bg_pixmap(xcb_connection_t *conn, xcb_screen_t *scr, u_int32_t *resolution, uint32_t color);
+bool create_shm_image(xcb_connection_t *conn, xcb_screen_t *scr, uint32_t width, uint32_t height, bool writable, shm_image_t *image);
+void put_shm_image(xcb_connection_t *conn, xcb_drawable_t drawable, xcb_gcontext_t gc, shm_image_t *image);
+void free_shm_image(xcb_connection_t *conn, shm_image_t *image);
+bool get_root_image(xcb_connection_t *conn, xcb_screen_t *scr, uint8_t *data, uint32_t stride);
+xcb_window_t open_fullscreen_window(xcb_connection_t *conn, xcb_screen_t *scr, uint32_t color, xcb_pixmap_t pixmap);
+void map_fullscreen_window(xcb_connection_t *conn, xcb_window_t win);
+bool grab_pointer_and_keyboard(xcb_connection_t *conn, xcb_screen_t *screen, xcb_cursor_t cursor);
 void dpms_set_mode(xcb_connection_t *conn, xcb_dpms_dpms_mode_t mode);
 xcb_cursor_t create_cursor(xcb_connection_t *conn, xcb_screen_t *screen, xcb_window_t win, int choice);
 
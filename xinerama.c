@@ -16,6 +16,7 @@
 #include "i3lock.h"
 #include "xcb.h"
 #include "xinerama.h"
+#include "stats.h"
 
 /* Number of Xinerama screens which are currently present. */
 int xr_screens = 0;
@@ -23,42 +24,64 @@ int xr_screens = 0;
 /* The resolutions of the currently present Xinerama screens. */
 Rect *xr_resolutions;
 
+/* The scaling factors of the currently present screens, parallel to
+ * xr_resolutions. NULL (or an entry of 0) means the physical size of the
+ * screen is unknown, and the scaling factor of the root screen is used. */
+double *xr_scales;
+
 static bool xinerama_active;
 extern bool debug_mode;
 
+/* The initial requests sent by xinerama_init(), see xinerama_query_screens(). */
+static bool initial_requests_pending;
+static xcb_xinerama_is_active_cookie_t is_active_cookie;
+static xcb_xinerama_query_screens_cookie_t initial_screens_cookie;
+
+/*
+ * Sends the requests for the initial Xinerama configuration without waiting
+ * for their replies, so that other requests can be sent in the meantime. The
+ * replies are collected by the first xinerama_query_screens().
+ *
+ */
 void xinerama_init(void) {
     if (!xcb_get_extension_data(conn, &xcb_xinerama_id)->present) {
         DEBUG("Xinerama extension not found, disabling.\n");
         return;
     }
 
-    xcb_xinerama_is_active_cookie_t cookie;
-    xcb_xinerama_is_active_reply_t *reply;
-
-    cookie = xcb_xinerama_is_active(conn);
-    reply = xcb_xinerama_is_active_reply(conn, cookie, NULL);
-    if (!reply)
-        return;
-
-    if (!reply->state) {
-        free(reply);
-        return;
-    }
-
-    xinerama_active = true;
-    free(reply);
+    is_active_cookie = xcb_xinerama_is_active(conn);
+    initial_screens_cookie = xcb_xinerama_query_screens_unchecked(conn);
+    initial_requests_pending = true;
 }
 
 void xinerama_query_screens(void) {
-    if (!xinerama_active)
-        return;
-
     xcb_xinerama_query_screens_cookie_t cookie;
     xcb_xinerama_query_screens_reply_t *reply;
     xcb_xinerama_screen_info_t *screen_info;
 
-    cookie = xcb_xinerama_query_screens_unchecked(conn);
-    reply = xcb_xinerama_query_screens_reply(conn, cookie, NULL);
+    /* The initial QueryScreens was sent together with IsActive. */
+    bool batched = initial_requests_pending;
+    if (initial_requests_pending) {
+        initial_requests_pending = false;
+
+        xcb_xinerama_is_active_reply_t *active_reply;
+        active_reply = ROUND_TRIP(xcb_xinerama_is_active_reply(conn, is_active_cookie, NULL));
+        xinerama_active = (active_reply && active_reply->state);
+        free(active_reply);
+
+        if (!xinerama_active) {
+            xcb_discard_reply(conn, initial_screens_cookie.sequence);
+            return;
+        }
+        cookie = initial_screens_cookie;
+    } else {
+        if (!xinerama_active)
+            return;
+
+        cookie = xcb_xinerama_query_screens_unchecked(conn);
+    }
+
+    reply = ROUND_TRIP_IF(!batched, xcb_xinerama_query_screens_reply(conn, cookie, NULL));
     if (!reply) {
         if (debug_mode)
             fprintf(stderr, "Couldn't get Xinerama screens\n");
@@ -73,8 +96,12 @@ void xinerama_query_screens(void) {
         free(reply);
         return;
     }
+    free(xr_resolutions);
     xr_resolutions = resolutions;
     xr_screens = screens;
+    /* Xinerama does not tell us the physical size of the screens. */
+    free(xr_scales);
+    xr_scales = NULL;
 
     for (int screen = 0; screen < xr_screens; screen++) {
         xr_resolutions[screen].x = screen_info[screen].x_org;
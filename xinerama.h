@@ -10,6 +10,7 @@ typedef struct Rect {
 
 extern int xr_screens;
 extern Rect *xr_resolutions;
+extern double *xr_scales;
 
 void xinerama_init(void);
 void xinerama_query_screens(void);